@@ -0,0 +1,362 @@
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "avs_host.h"
+
+struct AVS_ScriptEnvironment
+{
+    int cpuFlags;
+};
+
+struct AVS_Clip
+{
+    std::atomic<int> refcount;
+    AVS_VideoInfo vi;
+    AVS_FilterInfo *fi;
+    BenchSource source;
+};
+
+struct BenchProp
+{
+    char type;
+    int64_t i;
+    double d;
+    std::string s;
+};
+
+// Frame properties, frame->properties points to it.
+struct BenchProps
+{
+    AVS_Map map;
+    std::map<std::string, BenchProp> props;
+};
+
+// Frames are touched by the prefetch/submitter threads of the filters as well.
+static std::mutex propsLock;
+
+static inline int bench_plane_index(int plane)
+{
+    switch (plane)
+    {
+        case AVS_PLANAR_U:
+        case AVS_PLANAR_B: return 1;
+        case AVS_PLANAR_V:
+        case AVS_PLANAR_R: return 2;
+        default: return 0;
+    }
+}
+
+AVS_ScriptEnvironment *bench_new_env(int cpuFlags)
+{
+    return new AVS_ScriptEnvironment{cpuFlags};
+}
+
+void bench_delete_env(AVS_ScriptEnvironment *env)
+{
+    delete env;
+}
+
+AVS_Clip *bench_new_source(const AVS_VideoInfo &vi, BenchSource source)
+{
+    AVS_Clip *clip = new AVS_Clip{};
+    clip->refcount = 1;
+    clip->vi = vi;
+    clip->source = std::move(source);
+
+    return clip;
+}
+
+AVS_VideoFrame *bench_new_frame(const AVS_VideoInfo &vi)
+{
+    const int bits = avs_bits_per_component(&vi);
+    const int bytes = (bits == 8) ? 1 : (bits == 32) ? 4 : 2;
+    const bool rgb = avs_is_rgb(&vi);
+    const int ssw = (rgb || avs_is_444(&vi)) ? 0 : 1;
+    const int ssh = (!rgb && avs_is_420(&vi)) ? 1 : 0;
+
+    AVS_VideoFrame *frame = new AVS_VideoFrame{};
+    frame->refcount = 1;
+    frame->row_size = vi.width * bytes;
+    frame->pitch = (frame->row_size + 63) & ~63;
+    frame->height = vi.height;
+    frame->row_sizeUV = (vi.width >> ssw) * bytes;
+    frame->pitchUV = (frame->row_sizeUV + 63) & ~63;
+    frame->heightUV = vi.height >> ssh;
+    frame->offset = 0;
+    frame->offsetU = frame->pitch * frame->height;
+    frame->offsetV = frame->offsetU + frame->pitchUV * frame->heightUV;
+
+    frame->vfb = new AVS_VideoFrameBuffer{};
+    frame->vfb->data_size = frame->offsetV + frame->pitchUV * frame->heightUV;
+    frame->vfb->data = static_cast<BYTE *>(calloc(frame->vfb->data_size, 1));
+    frame->vfb->refcount = 1;
+
+    return frame;
+}
+
+BYTE *bench_get_write_ptr(AVS_VideoFrame *frame, int plane)
+{
+    return const_cast<BYTE *>(avs_get_read_ptr_p(frame, plane));
+}
+
+const char *bench_clip_error(AVS_Clip *clip)
+{
+    return (clip->fi && clip->fi->error) ? clip->fi->error : "unknown error";
+}
+
+int bench_cpu_flags()
+{
+    int flags = 0;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    if (__builtin_cpu_supports("sse2"))
+        flags |= AVS_CPU_SSE2;
+    if (__builtin_cpu_supports("avx2"))
+        flags |= AVS_CPUF_AVX2;
+    if (__builtin_cpu_supports("fma"))
+        flags |= AVS_CPUF_FMA3;
+    if (__builtin_cpu_supports("avx512f"))
+        flags |= AVS_CPUF_AVX512F;
+    if (__builtin_cpu_supports("avx512bw"))
+        flags |= AVS_CPUF_AVX512BW;
+    if (__builtin_cpu_supports("avx512dq"))
+        flags |= AVS_CPUF_AVX512DQ;
+    if (__builtin_cpu_supports("avx512vl"))
+        flags |= AVS_CPUF_AVX512VL;
+#endif
+
+    return flags;
+}
+
+extern "C" {
+
+int AVSC_CC avs_check_version(AVS_ScriptEnvironment *, int)
+{
+    return 0;
+}
+
+int AVSC_CC avs_get_cpu_flags(AVS_ScriptEnvironment *env)
+{
+    return env->cpuFlags;
+}
+
+void AVSC_CC avs_bit_blt(AVS_ScriptEnvironment *, BYTE *dstp, int dst_pitch, const BYTE *srcp, int src_pitch, int row_size, int height)
+{
+    for (int y = 0; y < height; ++y)
+        memcpy(dstp + static_cast<size_t>(y) * dst_pitch, srcp + static_cast<size_t>(y) * src_pitch, row_size);
+}
+
+int AVSC_CC avs_bits_per_component(const AVS_VideoInfo *p)
+{
+    static constexpr int bits[] = {8, 16, 32, 0, 0, 10, 12, 14};
+    return bits[(p->pixel_type & AVS_CS_SAMPLE_BITS_MASK) >> AVS_CS_SHIFT_SAMPLE_BITS];
+}
+
+int AVSC_CC avs_num_components(const AVS_VideoInfo *p)
+{
+    return (p->pixel_type & (AVS_CS_YUVA | AVS_CS_RGBA_TYPE)) ? 4 : 3;
+}
+
+static inline bool bench_is_yuv_format(const AVS_VideoInfo *p, int generic, int genericA)
+{
+    const int type = p->pixel_type & AVS_CS_PLANAR_MASK & ~AVS_CS_SAMPLE_BITS_MASK;
+    return type == (generic & AVS_CS_PLANAR_FILTER) || type == (genericA & AVS_CS_PLANAR_FILTER);
+}
+
+int AVSC_CC avs_is_420(const AVS_VideoInfo *p)
+{
+    return bench_is_yuv_format(p, AVS_CS_GENERIC_YUV420, AVS_CS_GENERIC_YUVA420);
+}
+
+int AVSC_CC avs_is_422(const AVS_VideoInfo *p)
+{
+    return bench_is_yuv_format(p, AVS_CS_GENERIC_YUV422, AVS_CS_GENERIC_YUVA422);
+}
+
+int AVSC_CC avs_is_444(const AVS_VideoInfo *p)
+{
+    return bench_is_yuv_format(p, AVS_CS_GENERIC_YUV444, AVS_CS_GENERIC_YUVA444);
+}
+
+int AVSC_CC avs_is_yv12(const AVS_VideoInfo *p)
+{
+    return (p->pixel_type & AVS_CS_PLANAR_MASK & AVS_CS_PLANAR_FILTER) == (AVS_CS_YV12 & AVS_CS_PLANAR_FILTER);
+}
+
+int AVSC_CC avs_get_pitch_p(const AVS_VideoFrame *p, int plane)
+{
+    return bench_plane_index(plane) ? p->pitchUV : p->pitch;
+}
+
+int AVSC_CC avs_get_row_size_p(const AVS_VideoFrame *p, int plane)
+{
+    return bench_plane_index(plane) ? p->row_sizeUV : p->row_size;
+}
+
+int AVSC_CC avs_get_height_p(const AVS_VideoFrame *p, int plane)
+{
+    return bench_plane_index(plane) ? p->heightUV : p->height;
+}
+
+const BYTE *AVSC_CC avs_get_read_ptr_p(const AVS_VideoFrame *p, int plane)
+{
+    switch (bench_plane_index(plane))
+    {
+        case 1: return p->vfb->data + p->offsetU;
+        case 2: return p->vfb->data + p->offsetV;
+        default: return p->vfb->data + p->offset;
+    }
+}
+
+AVS_VideoFrame *AVSC_CC avs_copy_video_frame(AVS_VideoFrame *frame)
+{
+    __atomic_add_fetch(&frame->refcount, 1, __ATOMIC_ACQ_REL);
+    return frame;
+}
+
+void AVSC_CC avs_release_video_frame(AVS_VideoFrame *frame)
+{
+    if (!frame || __atomic_sub_fetch(&frame->refcount, 1, __ATOMIC_ACQ_REL))
+        return;
+
+    free(frame->vfb->data);
+    delete frame->vfb;
+    delete static_cast<BenchProps *>(frame->properties);
+    delete frame;
+}
+
+const AVS_Map *AVSC_CC avs_get_frame_props_ro(AVS_ScriptEnvironment *env, const AVS_VideoFrame *frame)
+{
+    return avs_get_frame_props_rw(env, const_cast<AVS_VideoFrame *>(frame));
+}
+
+AVS_Map *AVSC_CC avs_get_frame_props_rw(AVS_ScriptEnvironment *, AVS_VideoFrame *frame)
+{
+    std::lock_guard<std::mutex> lock(propsLock);
+
+    if (!frame->properties)
+    {
+        BenchProps *props = new BenchProps();
+        props->map.data = props;
+        frame->properties = props;
+    }
+
+    return &static_cast<BenchProps *>(frame->properties)->map;
+}
+
+const char *AVSC_CC avs_prop_get_data(AVS_ScriptEnvironment *, const AVS_Map *map, const char *key, int, int *error)
+{
+    std::lock_guard<std::mutex> lock(propsLock);
+
+    const auto &props = static_cast<BenchProps *>(map->data)->props;
+    const auto it = props.find(key);
+
+    if (it == props.end() || it->second.type != 's')
+    {
+        *error = (it == props.end()) ? AVS_GETPROPERROR_UNSET : AVS_GETPROPERROR_TYPE;
+        return nullptr;
+    }
+
+    *error = 0;
+    return it->second.s.c_str();
+}
+
+int AVSC_CC avs_prop_set_int(AVS_ScriptEnvironment *, AVS_Map *map, const char *key, int64_t i, int)
+{
+    std::lock_guard<std::mutex> lock(propsLock);
+    static_cast<BenchProps *>(map->data)->props[key] = BenchProp{'i', i, 0.0, {}};
+    return 0;
+}
+
+int AVSC_CC avs_prop_set_float(AVS_ScriptEnvironment *, AVS_Map *map, const char *key, double d, int)
+{
+    std::lock_guard<std::mutex> lock(propsLock);
+    static_cast<BenchProps *>(map->data)->props[key] = BenchProp{'f', 0, d, {}};
+    return 0;
+}
+
+AVS_Clip *AVSC_CC avs_take_clip(AVS_Value v, AVS_ScriptEnvironment *)
+{
+    AVS_Clip *clip = static_cast<AVS_Clip *>(v.d.clip);
+    clip->refcount++;
+
+    return clip;
+}
+
+void AVSC_CC avs_set_to_clip(AVS_Value *v, AVS_Clip *clip)
+{
+    clip->refcount++;
+    v->type = 'c';
+    v->array_size = 0;
+    v->d.clip = clip;
+}
+
+void AVSC_CC avs_release_value(AVS_Value v)
+{
+    if (avs_is_clip(v))
+        avs_release_clip(static_cast<AVS_Clip *>(v.d.clip));
+}
+
+void AVSC_CC avs_release_clip(AVS_Clip *clip)
+{
+    // As in AviSynth, releasing a null clip is a no-op.
+    if (!clip || --clip->refcount)
+        return;
+
+    if (clip->fi)
+    {
+        if (clip->fi->free_filter)
+            clip->fi->free_filter(clip->fi);
+        if (clip->fi->child)
+            avs_release_clip(clip->fi->child);
+
+        delete clip->fi;
+    }
+
+    delete clip;
+}
+
+const AVS_VideoInfo *AVSC_CC avs_get_video_info(AVS_Clip *clip)
+{
+    return clip->fi ? &clip->fi->vi : &clip->vi;
+}
+
+AVS_VideoFrame *AVSC_CC avs_get_frame(AVS_Clip *clip, int n)
+{
+    if (clip->fi)
+    {
+        clip->fi->error = nullptr;
+        return clip->fi->get_frame(clip->fi, n);
+    }
+
+    return clip->source(n);
+}
+
+AVS_Clip *AVSC_CC avs_new_c_filter(AVS_ScriptEnvironment *env, AVS_FilterInfo **fi, AVS_Value child, int store_child)
+{
+    AVS_FilterInfo *info = new AVS_FilterInfo{};
+    info->env = env;
+
+    if (avs_is_clip(child))
+    {
+        info->vi = *avs_get_video_info(static_cast<AVS_Clip *>(child.d.clip));
+
+        if (store_child)
+            info->child = avs_take_clip(child, env);
+    }
+
+    AVS_Clip *clip = new AVS_Clip{};
+    clip->refcount = 1;
+    clip->fi = info;
+    clip->vi = info->vi;
+
+    *fi = info;
+    return clip;
+}
+
+}
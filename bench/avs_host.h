@@ -0,0 +1,25 @@
+#pragma once
+
+// A minimal in-process implementation of the AviSynth C API functions used by the filters,
+// so that vmaf_bench can call Create_VMAF/Create_VMAF2 and get_frame without AviSynth.
+
+#include <functional>
+
+#include "avisynth_c.h"
+
+// Returns frame n of a source clip (one reference owned by the caller).
+using BenchSource = std::function<AVS_VideoFrame *(int n)>;
+
+AVS_ScriptEnvironment *bench_new_env(int cpuFlags);
+void bench_delete_env(AVS_ScriptEnvironment *env);
+
+// The returned clip holds one reference, released with avs_release_clip.
+AVS_Clip *bench_new_source(const AVS_VideoInfo &vi, BenchSource source);
+// A frame of the format of vi not owned by any clip (refcount 1).
+AVS_VideoFrame *bench_new_frame(const AVS_VideoInfo &vi);
+BYTE *bench_get_write_ptr(AVS_VideoFrame *frame, int plane);
+// The error of the last failed get_frame of a filter clip.
+const char *bench_clip_error(AVS_Clip *clip);
+
+// The CPU flags of the running CPU (the SIMD levels the filters check).
+int bench_cpu_flags();
@@ -0,0 +1,823 @@
+// vmaf_bench - runs VMAF/VMAF2 (the same ingest and scoring code as the plugin) on synthetic or Y4M frames
+// without AviSynth and reports fps, per-frame latency percentiles, peak RSS and the pictures allocated
+// after the first frame (must be 0 for VMAF, libvmaf's preallocated pictures are reused).
+//
+// vmaf_bench [--filter vmaf,vmaf2] [--res sd,hd,4k,8k,WxH] [--bits 8,10,12,16,32] [--feature LIST]... [--frames N]
+//            [--model vmaf|vmaf_neg|vmaf_b|vmaf_4k|none] [--log-format N] [--queue-depth N] [--threads N]
+//            [--thread-weight F] [--timing N] [--trace-path FILE] [--host-threads N] [--cpu c|avx2|avx512]
+//            [--ref ref.y4m --dist dist.y4m]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "avs_host.h"
+#include "VMAF.h"
+
+struct BenchResolution
+{
+    std::string name;
+    int width;
+    int height;
+};
+
+struct BenchOptions
+{
+    std::vector<std::string> filters{"vmaf"};
+    std::vector<BenchResolution> resolutions;
+    std::vector<int> bits{8};
+    std::vector<std::vector<int>> features;
+    int frames = 100;
+    int model = 0;
+    int logFormat = -1;
+    int queueDepth = -1;
+    // -1 - not passed, the filter's default is used.
+    int threads = -1;
+    double threadWeight = -1.0;
+    int timing = -1;
+    std::string tracePath;
+    int hostThreads = 1;
+    int cpuFlags = bench_cpu_flags();
+    std::string ref;
+    std::string dist;
+};
+
+struct BenchResult
+{
+    double seconds;
+    double fps;
+    double p50;
+    double p95;
+    double p99;
+    double peakMiB;
+    // Pictures allocated after the first frame (VMAF takes them from the preallocated pool).
+    uint64_t allocations;
+};
+
+static constexpr const char *featureArg[] = {"psnr", "psnr_hvs", "ssim", "ms_ssim", "ciede", "cambi"};
+
+[[noreturn]] static void bench_usage(const char *error)
+{
+    if (error)
+        fprintf(stderr, "vmaf_bench: %s\n\n", error);
+
+    fprintf(stderr,
+        "Usage: vmaf_bench [options]\n"
+        "  --filter LIST       vmaf, vmaf2 (default: vmaf)\n"
+        "  --res LIST          sd, hd, 4k, 8k or WxH (default: sd,hd,4k)\n"
+        "  --bits LIST         8, 10, 12, 14, 16, 32 (default: 8)\n"
+        "  --feature LIST      psnr, psnr_hvs, ssim, ms_ssim, ciede, cambi or none; once per feature set\n"
+        "                      (default: none for vmaf, psnr for vmaf2)\n"
+        "  --frames N          frames per run (default: 100)\n"
+        "  --model NAME        vmaf, vmaf_neg, vmaf_b, vmaf_4k or none (VMAF, default: vmaf)\n"
+        "  --log-format N      log_format of VMAF (the log is discarded)\n"
+        "  --queue-depth N     queue_depth of VMAF\n"
+        "  --threads N         threads of libvmaf (default: a share of the thread budget)\n"
+        "  --thread-weight F   thread_weight\n"
+        "  --timing N          timing (VMAF2: 0 or 1)\n"
+        "  --trace-path FILE   trace_path (written by every run, the last one is kept)\n"
+        "  --host-threads N    threads requesting frames (default: 1)\n"
+        "  --cpu NAME          c, avx2 or avx512 (default: the CPU)\n"
+        "  --ref FILE --dist FILE\n"
+        "                      Y4M clips instead of the synthetic frames (--res and --bits are not used)\n");
+    exit(1);
+}
+
+static std::vector<std::string> bench_split(const std::string &list)
+{
+    std::vector<std::string> items;
+    std::stringstream ss(list);
+
+    for (std::string item; std::getline(ss, item, ',');)
+    {
+        if (!item.empty())
+            items.emplace_back(item);
+    }
+
+    return items;
+}
+
+static int bench_int(const char *s, int min)
+{
+    char *end;
+    const long i = strtol(s, &end, 10);
+
+    if (*end || i < min)
+        bench_usage(("invalid number "s + s).c_str());
+
+    return static_cast<int>(i);
+}
+
+static double bench_double(const char *s)
+{
+    char *end;
+    const double d = strtod(s, &end);
+
+    if (*end || !(d > 0.0))
+        bench_usage(("invalid number "s + s).c_str());
+
+    return d;
+}
+
+static BenchOptions bench_parse(int argc, char **argv)
+{
+    BenchOptions o;
+    std::vector<std::string> res{"sd", "hd", "4k"};
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+
+        if (arg == "-h" || arg == "--help")
+            bench_usage(nullptr);
+        if (i + 1 >= argc)
+            bench_usage(("missing value of " + arg).c_str());
+
+        const char *value = argv[++i];
+
+        if (arg == "--filter")
+        {
+            o.filters = bench_split(value);
+
+            for (auto &f : o.filters)
+            {
+                if (f != "vmaf" && f != "vmaf2")
+                    bench_usage(("unknown filter " + f).c_str());
+            }
+        }
+        else if (arg == "--res")
+            res = bench_split(value);
+        else if (arg == "--bits")
+        {
+            o.bits.clear();
+
+            for (auto &b : bench_split(value))
+            {
+                const int bits = bench_int(b.c_str(), 8);
+
+                if (bits != 8 && bits != 10 && bits != 12 && bits != 14 && bits != 16 && bits != 32)
+                    bench_usage(("unsupported bit depth " + b).c_str());
+
+                o.bits.emplace_back(bits);
+            }
+        }
+        else if (arg == "--feature")
+        {
+            std::vector<int> set;
+
+            for (auto &f : bench_split(value))
+            {
+                if (f == "none")
+                    continue;
+
+                const auto it = std::find_if(std::begin(featureArg), std::end(featureArg), [&](const char *name) { return f == name; });
+
+                if (it == std::end(featureArg))
+                    bench_usage(("unknown feature " + f).c_str());
+
+                set.emplace_back(static_cast<int>(it - std::begin(featureArg)));
+            }
+
+            o.features.emplace_back(set);
+        }
+        else if (arg == "--frames")
+            o.frames = bench_int(value, 1);
+        else if (arg == "--model")
+        {
+            if (!strcmp(value, "none"))
+                o.model = -1;
+            else
+            {
+                const auto it = std::find_if(std::begin(modelName), std::end(modelName), [&](const char *name) { return !strcmp(value, name); });
+
+                if (it == std::end(modelName))
+                    bench_usage(("unknown model "s + value).c_str());
+
+                o.model = static_cast<int>(it - std::begin(modelName));
+            }
+        }
+        else if (arg == "--log-format")
+            o.logFormat = bench_int(value, 0);
+        else if (arg == "--queue-depth")
+            o.queueDepth = bench_int(value, 0);
+        else if (arg == "--threads")
+            o.threads = bench_int(value, 0);
+        else if (arg == "--thread-weight")
+            o.threadWeight = bench_double(value);
+        else if (arg == "--timing")
+            o.timing = bench_int(value, 0);
+        else if (arg == "--trace-path")
+            o.tracePath = value;
+        else if (arg == "--host-threads")
+            o.hostThreads = bench_int(value, 1);
+        else if (arg == "--cpu")
+        {
+            if (!strcmp(value, "c"))
+                o.cpuFlags = 0;
+            else if (!strcmp(value, "avx2"))
+                o.cpuFlags &= ~(AVS_CPUF_AVX512F | AVS_CPUF_AVX512BW | AVS_CPUF_AVX512DQ | AVS_CPUF_AVX512VL);
+            else if (strcmp(value, "avx512"))
+                bench_usage(("unknown cpu "s + value).c_str());
+        }
+        else if (arg == "--ref")
+            o.ref = value;
+        else if (arg == "--dist")
+            o.dist = value;
+        else
+            bench_usage(("unknown option " + arg).c_str());
+    }
+
+    if (o.ref.empty() != o.dist.empty())
+        bench_usage("--ref and --dist must be used together");
+
+    for (auto &r : res)
+    {
+        if (r == "sd")
+            o.resolutions.push_back({r, 720, 480});
+        else if (r == "hd")
+            o.resolutions.push_back({r, 1920, 1080});
+        else if (r == "4k")
+            o.resolutions.push_back({r, 3840, 2160});
+        else if (r == "8k")
+            o.resolutions.push_back({r, 7680, 4320});
+        else
+        {
+            int w, h;
+            char tail;
+
+            if (sscanf(r.c_str(), "%dx%d%c", &w, &h, &tail) != 2 || w < 16 || h < 16 || w % 2 || h % 2)
+                bench_usage(("invalid resolution " + r).c_str());
+
+            o.resolutions.push_back({r, w, h});
+        }
+    }
+
+    return o;
+}
+
+static int bench_pixel_type(int bits)
+{
+    switch (bits)
+    {
+        case 10: return AVS_CS_YUV420P10;
+        case 12: return AVS_CS_YUV420P12;
+        case 14: return AVS_CS_YUV420P14;
+        case 16: return AVS_CS_YUV420P16;
+        case 32: return AVS_CS_YUV420PS;
+        default: return AVS_CS_YV12;
+    }
+}
+
+// Synthetic clips: a moving gradient with noise, the distorted clip has stronger noise and a lower contrast.
+// A few frames are generated up front and handed out in turn, so the source costs nothing while scoring.
+class BenchSyntheticClip
+{
+public:
+    static constexpr int ringSize = 8;
+
+    BenchSyntheticClip(const AVS_VideoInfo &vi, bool distorted)
+    {
+        const int bits = avs_bits_per_component(&vi);
+        static constexpr int planes[] = {AVS_PLANAR_Y, AVS_PLANAR_U, AVS_PLANAR_V};
+
+        for (int n = 0; n < ringSize; ++n)
+        {
+            AVS_VideoFrame *frame = bench_new_frame(vi);
+            uint32_t seed = 0x9e3779b9u * (n + 1);
+
+            for (int p = 0; p < 3; ++p)
+            {
+                BYTE *dstp = bench_get_write_ptr(frame, planes[p]);
+                const int pitch = avs_get_pitch_p(frame, planes[p]);
+                const int width = avs_get_row_size_p(frame, planes[p]) / ((bits == 8) ? 1 : (bits == 32) ? 4 : 2);
+                const int height = avs_get_height_p(frame, planes[p]);
+
+                // Separable pattern, sin() is called per row and column only.
+                std::vector<double> row(width);
+                for (int x = 0; x < width; ++x)
+                    row[x] = std::sin((x + 4 * n) * 0.02);
+
+                for (int y = 0; y < height; ++y)
+                {
+                    const double col = std::sin(y * (0.013 + p * 0.005));
+
+                    for (int x = 0; x < width; ++x)
+                    {
+                        seed = seed * 1664525u + 1013904223u;
+                        const double noise = (static_cast<int>(seed >> 24) - 128) / 128.0 * (distorted ? 0.03 : 0.01);
+                        double s = 0.5 + (p ? 0.1 : 0.25) * row[x] + (p ? 0.05 : 0.1) * col + noise;
+
+                        if (distorted)
+                            s = 0.5 + (s - 0.5) * 0.93;
+
+                        s = std::clamp(s, 0.0, 1.0);
+
+                        if (bits == 32)
+                            reinterpret_cast<float *>(dstp + y * pitch)[x] = static_cast<float>(p ? s - 0.5 : s);
+                        else if (bits == 8)
+                            dstp[y * pitch + x] = static_cast<uint8_t>(s * 255.0 + 0.5);
+                        else
+                            reinterpret_cast<uint16_t *>(dstp + y * pitch)[x] = static_cast<uint16_t>(s * ((1 << bits) - 1) + 0.5);
+                    }
+                }
+            }
+
+            ring_[n] = frame;
+        }
+    }
+
+    ~BenchSyntheticClip()
+    {
+        for (auto frame : ring_)
+            avs_release_video_frame(frame);
+    }
+
+    AVS_VideoFrame *get_frame(int n)
+    {
+        return avs_copy_video_frame(ring_[n % ringSize]);
+    }
+
+    size_t memory() const
+    {
+        return static_cast<size_t>(ring_[0]->vfb->data_size) * ringSize;
+    }
+
+private:
+    AVS_VideoFrame *ring_[ringSize];
+};
+
+// 64-bit file offsets (`long` of fseek/ftell is 32-bit on Windows).
+static int bench_seek(FILE *file, int64_t offset, int origin)
+{
+#if defined(_WIN32)
+    return _fseeki64(file, offset, origin);
+#else
+    return fseeko(file, static_cast<off_t>(offset), origin);
+#endif
+}
+
+static int64_t bench_tell(FILE *file)
+{
+#if defined(_WIN32)
+    return _ftelli64(file);
+#else
+    return ftello(file);
+#endif
+}
+
+// Y4M clips (420/422/444, 8..16-bit), the frames are read when requested.
+class BenchY4MClip
+{
+public:
+    explicit BenchY4MClip(const std::string &path) : vi_(), file_(fopen(path.c_str(), "rb"), fclose)
+    {
+        if (!file_)
+            throw std::runtime_error("cannot open " + path);
+
+        char header[256];
+
+        if (!fgets(header, sizeof(header), file_.get()) || strncmp(header, "YUV4MPEG2 ", 10))
+            throw std::runtime_error(path + " is not a Y4M file");
+
+        std::string colorspace = "420";
+        vi_.fps_numerator = 25;
+        vi_.fps_denominator = 1;
+
+        std::stringstream ss(header + 10);
+
+        for (std::string token; ss >> token;)
+        {
+            switch (token[0])
+            {
+                case 'W': vi_.width = atoi(token.c_str() + 1); break;
+                case 'H': vi_.height = atoi(token.c_str() + 1); break;
+                case 'F': sscanf(token.c_str() + 1, "%u:%u", &vi_.fps_numerator, &vi_.fps_denominator); break;
+                case 'C': colorspace = token.substr(1); break;
+            }
+        }
+
+        const int bits = (colorspace.find("p10") != std::string::npos) ? 10 : (colorspace.find("p12") != std::string::npos) ? 12 : (colorspace.find("p16") != std::string::npos) ? 16 : 8;
+        const int sampleBits = (bits == 10) ? AVS_CS_SAMPLE_BITS_10 : (bits == 12) ? AVS_CS_SAMPLE_BITS_12 : (bits == 16) ? AVS_CS_SAMPLE_BITS_16 : AVS_CS_SAMPLE_BITS_8;
+
+        if (!colorspace.compare(0, 3, "420"))
+            vi_.pixel_type = AVS_CS_GENERIC_YUV420 | sampleBits;
+        else if (!colorspace.compare(0, 3, "422"))
+            vi_.pixel_type = AVS_CS_GENERIC_YUV422 | sampleBits;
+        else if (!colorspace.compare(0, 3, "444") && colorspace.compare(0, 5, "444al"))
+            vi_.pixel_type = AVS_CS_GENERIC_YUV444 | sampleBits;
+        else
+            throw std::runtime_error(path + ": unsupported colorspace " + colorspace);
+
+        if (vi_.width <= 0 || vi_.height <= 0)
+            throw std::runtime_error(path + ": missing frame dimensions");
+
+        const int bytes = (bits == 8) ? 1 : 2;
+        const int ssw = avs_is_444(&vi_) ? 0 : 1;
+        const int ssh = avs_is_420(&vi_) ? 1 : 0;
+        rowSize_[0] = vi_.width * bytes;
+        rowSize_[1] = rowSize_[2] = (vi_.width >> ssw) * bytes;
+        height_[0] = vi_.height;
+        height_[1] = height_[2] = vi_.height >> ssh;
+        dataOffset_ = bench_tell(file_.get());
+
+        // The frame headers are assumed to have the same length as the first one.
+        char frameHeader[256];
+
+        if (!fgets(frameHeader, sizeof(frameHeader), file_.get()) || strncmp(frameHeader, "FRAME", 5))
+            throw std::runtime_error(path + " has no frames");
+
+        frameSize_ = static_cast<int64_t>(strlen(frameHeader)) + rowSize_[0] * height_[0] + 2 * rowSize_[1] * height_[1];
+        frameHeaderSize_ = static_cast<int>(strlen(frameHeader));
+
+        bench_seek(file_.get(), 0, SEEK_END);
+        vi_.num_frames = static_cast<int>((bench_tell(file_.get()) - dataOffset_) / frameSize_);
+    }
+
+    const AVS_VideoInfo &vi() const
+    {
+        return vi_;
+    }
+
+    AVS_VideoFrame *get_frame(int n)
+    {
+        static constexpr int planes[] = {AVS_PLANAR_Y, AVS_PLANAR_U, AVS_PLANAR_V};
+
+        AVS_VideoFrame *frame = bench_new_frame(vi_);
+
+        std::lock_guard<std::mutex> lock(lock_);
+
+        bench_seek(file_.get(), dataOffset_ + n * frameSize_ + frameHeaderSize_, SEEK_SET);
+
+        for (int p = 0; p < 3; ++p)
+        {
+            BYTE *dstp = bench_get_write_ptr(frame, planes[p]);
+            const int pitch = avs_get_pitch_p(frame, planes[p]);
+
+            for (int y = 0; y < height_[p]; ++y)
+            {
+                if (fread(dstp + static_cast<size_t>(y) * pitch, 1, rowSize_[p], file_.get()) != static_cast<size_t>(rowSize_[p]))
+                    memset(dstp + static_cast<size_t>(y) * pitch, 0, rowSize_[p]);
+            }
+        }
+
+        return frame;
+    }
+
+private:
+    AVS_VideoInfo vi_;
+    std::unique_ptr<FILE, int (*)(FILE *)> file_;
+    std::mutex lock_;
+    int rowSize_[3];
+    int height_[3];
+    int64_t dataOffset_;
+    int64_t frameSize_;
+    int frameHeaderSize_;
+};
+
+// Peak RSS since the last reset in MiB. Windows has no reset, the peak is the one of the process.
+static void bench_reset_peak_rss()
+{
+#if defined(__linux__)
+    if (FILE *f = fopen("/proc/self/clear_refs", "w"))
+    {
+        fputs("5", f);
+        fclose(f);
+    }
+#endif
+}
+
+static double bench_peak_rss()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS pmc;
+
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return pmc.PeakWorkingSetSize / 1048576.0;
+#elif defined(__linux__)
+    if (FILE *f = fopen("/proc/self/status", "r"))
+    {
+        char line[256];
+        long kib = -1;
+
+        while (fgets(line, sizeof(line), f))
+        {
+            if (sscanf(line, "VmHWM: %ld kB", &kib) == 1)
+                break;
+        }
+
+        fclose(f);
+
+        if (kib >= 0)
+            return kib / 1024.0;
+    }
+#else
+    rusage usage;
+
+    if (!getrusage(RUSAGE_SELF, &usage))
+        return usage.ru_maxrss / 1048576.0;
+#endif
+
+    return 0.0;
+}
+
+static double bench_percentile(const std::vector<double> &sorted, double p)
+{
+    // Nearest rank.
+    const size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+    return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+// Creates the filter like AviSynth would (Create_VMAF/Create_VMAF2), requests frames 0..frames-1 and destroys it.
+static bool bench_run(const BenchOptions &o, AVS_ScriptEnvironment *env, const std::string &filter, AVS_Clip *ref, AVS_Clip *dist,
+    const std::vector<int> &feature, BenchResult *result)
+{
+#if defined(_WIN32)
+    static const char *logPath = "NUL";
+#else
+    static const char *logPath = "/dev/null";
+#endif
+
+    std::vector<AVS_Value> featureV;
+    std::vector<AVS_Value> modelV;
+
+    for (int f : feature)
+        featureV.emplace_back(avs_new_value_int(f));
+    if (o.model >= 0)
+        modelV.emplace_back(avs_new_value_int(o.model));
+
+    AVS_Value refV = avs_new_value_clip(ref);
+    AVS_Value distV = avs_new_value_clip(dist);
+    AVS_Value logV = avs_new_value_string(logPath);
+    AVS_Value traceV = avs_new_value_string(o.tracePath.c_str());
+    AVS_Value clipV;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    if (filter == "vmaf")
+    {
+        // Every parameter of the signature in plugin.cpp, as AviSynth passes them.
+        std::vector<AVS_Value> args(25, avs_void);
+        args[0] = refV;
+        args[1] = avs_new_value_array(&distV, 1);
+        args[2] = avs_new_value_array(&logV, 1);
+        if (o.logFormat >= 0)
+            args[3] = avs_new_value_int(o.logFormat);
+        args[4] = avs_new_value_array(modelV.data(), static_cast<int>(modelV.size()));
+        if (!featureV.empty())
+            args[5] = avs_new_value_array(featureV.data(), static_cast<int>(featureV.size()));
+        if (o.queueDepth >= 0)
+            args[7] = avs_new_value_int(o.queueDepth);
+        if (o.threads >= 0)
+            args[8] = avs_new_value_int(o.threads);
+        if (o.timing >= 0)
+            args[22] = avs_new_value_int(o.timing);
+        if (!o.tracePath.empty())
+            args[23] = traceV;
+        if (o.threadWeight > 0.0)
+            args[24] = avs_new_value_float(static_cast<float>(o.threadWeight));
+
+        clipV = Create_VMAF(env, avs_new_value_array(args.data(), static_cast<int>(args.size())), nullptr);
+    }
+    else
+    {
+        std::vector<AVS_Value> args(11, avs_void);
+        args[0] = refV;
+        args[1] = distV;
+        if (!featureV.empty())
+            args[2] = avs_new_value_array(featureV.data(), static_cast<int>(featureV.size()));
+        if (o.threads >= 0)
+            args[4] = avs_new_value_int(o.threads);
+        if (o.timing >= 0)
+            args[8] = avs_new_value_bool(o.timing > 0);
+        if (!o.tracePath.empty())
+            args[9] = traceV;
+        if (o.threadWeight > 0.0)
+            args[10] = avs_new_value_float(static_cast<float>(o.threadWeight));
+
+        clipV = Create_VMAF2(env, avs_new_value_array(args.data(), static_cast<int>(args.size())), nullptr);
+    }
+
+    avs_release_value(refV);
+    avs_release_value(distV);
+
+    if (avs_is_error(clipV))
+    {
+        fprintf(stderr, "  %s\n", avs_as_error(clipV));
+        return false;
+    }
+
+    AVS_Clip *clip = avs_take_clip(clipV, env);
+    avs_release_value(clipV);
+
+    const int frames = avs_get_video_info(clip)->num_frames;
+    const auto init = std::chrono::steady_clock::now();
+
+    std::vector<double> latency(frames);
+    std::atomic<int> next{0};
+    std::atomic<bool> failed{false};
+
+    auto fetch = [&](int n)
+    {
+        const auto t0 = std::chrono::steady_clock::now();
+        AVS_VideoFrame *frame = avs_get_frame(clip, n);
+        latency[n] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+
+        if (!frame)
+        {
+            if (!failed.exchange(true))
+                fprintf(stderr, "  frame %d: %s\n", n, bench_clip_error(clip));
+        }
+
+        avs_release_video_frame(frame);
+    };
+
+    // The first frame creates the contexts and their picture pools, the other ones are the steady state.
+    if (frames > 0)
+        fetch(next++);
+
+    const uint64_t allocations = vmafPictureAllocations;
+
+    auto worker = [&]()
+    {
+        for (int n; !failed && (n = next++) < frames;)
+            fetch(n);
+    };
+
+    std::vector<std::thread> workers;
+
+    for (int i = 1; i < o.hostThreads; ++i)
+        workers.emplace_back(worker);
+
+    worker();
+
+    for (auto &t : workers)
+        t.join();
+
+    // Scores still in flight and the logs are finished when the filter is destroyed.
+    avs_release_clip(clip);
+
+    const auto end = std::chrono::steady_clock::now();
+
+    if (failed)
+        return false;
+
+    result->allocations = vmafPictureAllocations - allocations;
+
+    std::sort(latency.begin(), latency.end());
+
+    result->seconds = std::chrono::duration<double>(end - start).count();
+    result->fps = frames / std::chrono::duration<double>(end - init).count();
+    result->p50 = bench_percentile(latency, 50.0);
+    result->p95 = bench_percentile(latency, 95.0);
+    result->p99 = bench_percentile(latency, 99.0);
+    result->peakMiB = bench_peak_rss();
+
+    return true;
+}
+
+static std::string bench_feature_name(const std::vector<int> &feature)
+{
+    std::string name;
+
+    for (int f : feature)
+        name += (name.empty() ? "" : "+") + std::string(featureArg[f]);
+
+    return name.empty() ? "none" : name;
+}
+
+// Returns false if VMAF allocated pictures after the first frame (the picture pool isn't used).
+static bool bench_print(const std::string &filter, const std::string &res, int bits, const std::vector<int> &feature, int frames,
+    const BenchResult &r)
+{
+    printf("%-6s %-10s %4d  %-22s %6d %9.2f %9.2f %9.2f %9.2f %9.2f %10.1f %7llu\n", filter.c_str(), res.c_str(), bits,
+        bench_feature_name(feature).c_str(), frames, r.seconds, r.fps, r.p50, r.p95, r.p99, r.peakMiB,
+        static_cast<unsigned long long>(r.allocations));
+    fflush(stdout);
+
+    if (filter == "vmaf" && r.allocations)
+    {
+        fprintf(stderr, "  vmaf: %llu pictures allocated after the first frame, expected 0 (libvmaf 3.0.0 picture preallocation).\n",
+            static_cast<unsigned long long>(r.allocations));
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    const BenchOptions o = bench_parse(argc, argv);
+    AVS_ScriptEnvironment *env = bench_new_env(o.cpuFlags);
+    // The flags vmaf_get_convert requires for the AVX-512 kernels.
+    constexpr int avx512Flags = AVS_CPUF_AVX512F | AVS_CPUF_AVX512BW | AVS_CPUF_AVX512DQ | AVS_CPUF_AVX512VL;
+
+    printf("cpu: %s, threads: %s, host threads: %d\n",
+        (o.cpuFlags & avx512Flags) == avx512Flags ? "avx512" : (o.cpuFlags & AVS_CPUF_AVX2) ? "avx2" : "c",
+        (o.threads >= 0) ? std::to_string(o.threads).c_str() : "thread budget", o.hostThreads);
+    printf("%-6s %-10s %4s  %-22s %6s %9s %9s %9s %9s %9s %10s %7s\n", "filter", "res", "bits", "feature", "frames", "total s", "fps",
+        "p50 ms", "p95 ms", "p99 ms", "peak MiB", "allocs");
+
+    int failures = 0;
+
+    for (auto &filter : o.filters)
+    {
+        const std::vector<std::vector<int>> features = !o.features.empty() ? o.features : (filter == "vmaf") ? std::vector<std::vector<int>>(1) :
+            std::vector<std::vector<int>>{{0}};
+
+        for (auto &feature : features)
+        {
+            if (!o.ref.empty())
+            {
+                try
+                {
+                    auto refY4M = std::make_shared<BenchY4MClip>(o.ref);
+                    auto distY4M = std::make_shared<BenchY4MClip>(o.dist);
+                    // The clips are cut to --frames.
+                    AVS_VideoInfo refVi = refY4M->vi();
+                    AVS_VideoInfo distVi = distY4M->vi();
+                    refVi.num_frames = std::min(o.frames, refVi.num_frames);
+                    distVi.num_frames = std::min(o.frames, distVi.num_frames);
+
+                    AVS_Clip *ref = bench_new_source(refVi, [refY4M](int n) { return refY4M->get_frame(n); });
+                    AVS_Clip *dist = bench_new_source(distVi, [distY4M](int n) { return distY4M->get_frame(n); });
+                    const std::string res = std::to_string(refVi.width) + "x" + std::to_string(refVi.height);
+                    BenchResult r;
+
+                    bench_reset_peak_rss();
+
+                    if (!bench_run(o, env, filter, ref, dist, feature, &r) ||
+                        !bench_print(filter, res, avs_bits_per_component(&refVi), feature, refVi.num_frames, r))
+                        ++failures;
+
+                    avs_release_clip(ref);
+                    avs_release_clip(dist);
+                }
+                catch (const std::exception &e)
+                {
+                    fprintf(stderr, "vmaf_bench: %s\n", e.what());
+                    return 1;
+                }
+
+                continue;
+            }
+
+            for (auto &res : o.resolutions)
+            {
+                for (int bits : o.bits)
+                {
+                    AVS_VideoInfo vi{};
+                    vi.width = res.width;
+                    vi.height = res.height;
+                    vi.pixel_type = bench_pixel_type(bits);
+                    vi.fps_numerator = 25;
+                    vi.fps_denominator = 1;
+                    vi.num_frames = o.frames;
+
+                    bench_reset_peak_rss();
+
+                    auto refSynthetic = std::make_shared<BenchSyntheticClip>(vi, false);
+                    auto distSynthetic = std::make_shared<BenchSyntheticClip>(vi, true);
+                    AVS_Clip *ref = bench_new_source(vi, [refSynthetic](int n) { return refSynthetic->get_frame(n); });
+                    AVS_Clip *dist = bench_new_source(vi, [distSynthetic](int n) { return distSynthetic->get_frame(n); });
+                    BenchResult r;
+
+                    if (bench_run(o, env, filter, ref, dist, feature, &r))
+                    {
+                        // The pre-generated frames are not part of the filter's memory.
+                        r.peakMiB -= (refSynthetic->memory() + distSynthetic->memory()) / 1048576.0;
+
+                        if (!bench_print(filter, res.name, bits, feature, o.frames, r))
+                            ++failures;
+                    }
+                    else
+                        ++failures;
+
+                    avs_release_clip(ref);
+                    avs_release_clip(dist);
+                }
+            }
+        }
+    }
+
+    bench_delete_env(env);
+
+    return failures ? 1 : 0;
+}
@@ -1,141 +1,1821 @@
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <sstream>
 #include <thread>
+#include <unordered_map>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 #include "VMAF.h"
 
-struct VMAF
+struct VMAFQueued
+{
+    AVS_VideoFrame *reference;
+    AVS_VideoFrame *distorted;
+};
+
+// P-square estimate of one quantile (Jain and Chlamtac) - five markers instead of every score.
+struct VMAFQuantile
+{
+    double p;
+    double q[5];
+    double pos[5];
+    double desired[5];
+    int64_t count;
+
+    void add(double x)
+    {
+        if (count < 5)
+        {
+            q[count++] = x;
+
+            if (count == 5)
+            {
+                std::sort(q, q + 5);
+
+                for (int i = 0; i < 5; ++i)
+                    pos[i] = i;
+
+                desired[0] = 0.0;
+                desired[1] = 2.0 * p;
+                desired[2] = 4.0 * p;
+                desired[3] = 2.0 + 2.0 * p;
+                desired[4] = 4.0;
+            }
+
+            return;
+        }
+
+        int k;
+
+        if (x < q[0])
+        {
+            q[0] = x;
+            k = 0;
+        }
+        else if (x >= q[4])
+        {
+            q[4] = x;
+            k = 3;
+        }
+        else
+            for (k = 0; x >= q[k + 1]; ++k);
+
+        for (int i = k + 1; i < 5; ++i)
+            ++pos[i];
+
+        const double increment[5] = {0.0, p / 2.0, p, (1.0 + p) / 2.0, 1.0};
+
+        for (int i = 0; i < 5; ++i)
+            desired[i] += increment[i];
+
+        // Moves the middle markers towards their desired position, parabolic if it keeps them ordered.
+        for (int i = 1; i < 4; ++i)
+        {
+            const double delta = desired[i] - pos[i];
+
+            if ((delta >= 1.0 && pos[i + 1] - pos[i] > 1.0) || (delta <= -1.0 && pos[i - 1] - pos[i] < -1.0))
+            {
+                const int d = (delta > 0.0) ? 1 : -1;
+
+                const double parabolic = q[i] + d / (pos[i + 1] - pos[i - 1]) *
+                    ((pos[i] - pos[i - 1] + d) * (q[i + 1] - q[i]) / (pos[i + 1] - pos[i]) +
+                     (pos[i + 1] - pos[i] - d) * (q[i] - q[i - 1]) / (pos[i] - pos[i - 1]));
+
+                if (q[i - 1] < parabolic && parabolic < q[i + 1])
+                    q[i] = parabolic;
+                else
+                    q[i] += d * (q[i + d] - q[i]) / (pos[i + d] - pos[i]);
+
+                pos[i] += d;
+            }
+        }
+
+        ++count;
+    }
+
+    double value() const
+    {
+        if (count >= 5)
+            return q[2];
+
+        // Too few scores for the markers - the exact quantile of the at most 4 scores, sorted by insertion.
+        double sorted[4];
+
+        for (int i = 0; i < count; ++i)
+        {
+            int j = i;
+
+            for (; j > 0 && sorted[j - 1] > q[i]; --j)
+                sorted[j] = sorted[j - 1];
+
+            sorted[j] = q[i];
+        }
+
+        return sorted[static_cast<int>(p * (count - 1) + 0.5)];
+    }
+};
+
+// Scores of the frames scored before with the same settings, kept in cache_path between runs.
+// Shared by all the filter instances using the same file.
+struct VMAFCache
+{
+    std::mutex mutex;
+    FILE *file;
+    size_t numScore;
+    std::unordered_map<uint64_t, std::vector<double>> scores;
+
+    ~VMAFCache()
+    {
+        if (file)
+            fclose(file);
+    }
+
+    bool find(uint64_t key, std::vector<double> &score)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        const auto it = scores.find(key);
+        if (it == scores.end())
+            return false;
+
+        score = it->second;
+        return true;
+    }
+
+    void add(uint64_t key, const std::vector<double> &score)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (!scores.emplace(key, score).second)
+            return;
+
+        // One record - the key followed by the scores.
+        fwrite(&key, sizeof(key), 1, file);
+        fwrite(score.data(), sizeof(double), score.size(), file);
+    }
+};
+
+// Running min/max/mean/harmonic mean and percentiles of one score.
+struct VMAFScorePool
+{
+    double min;
+    double max;
+    double sum;
+    double harmonicSum;
+    int64_t count;
+    std::vector<VMAFQuantile> quantile;
+};
+
+// One libvmaf context scoring the frames begin..end.
+// It is also fed the frame before and after its range so that the motion feature
+// at the range borders matches a single context scoring the whole clip.
+// In window mode the context is replaced every `window` frames the same way,
+// the previous one (`retired`) is kept until it gets the first frame of the next window.
+struct VMAFShard
+{
+    VmafContext *vmaf;
+    bool picturePool;
+    int base;
+    VmafContext *retired;
+    bool retiredPicturePool;
+    int retiredBase;
+    int begin;
+    int end;
+    int first;
+    int last;
+    int next;
+    // The frames before `submitted` went to the context, `next` is bumped already when the submitter takes a frame.
+    int submitted;
+    int written;
+    std::map<int, VMAFQueued> pending;
+    std::mutex queueMutex;
+    std::condition_variable queueCond;
+    std::thread submitter;
+    bool stop;
+    const char *error;
+    std::atomic<bool> flushed;
+    std::mutex scoreMutex;
+    // Signalled after frames are read, the context is flushed or an error is set.
+    std::condition_variable scoreCond;
+    uint64_t scoreVersion;
+    // cache_path - the key of a frame needs the next reference frame (motion), so every frame is held until the next one comes.
+    // `previous` is the frame before it, it starts the new context when scoring continues after frames from the cache.
+    VMAFQueued held;
+    int heldN;
+    uint64_t heldRef;
+    uint64_t heldDist;
+    VMAFQueued previous;
+    uint64_t previousRef;
+    int lastSubmitted;
+    bool lastMiss;
+    std::map<int, std::vector<double>> cached;
+    std::map<int, uint64_t> keys;
+    // step/keyframes - the context indexes of the sampled frames not streamed yet, the last frame passed by the submitter.
+    std::map<int, unsigned> samples;
+    unsigned numSamples;
+    int decided;
+    // log_format 4/5 - the records of the shards after the first one wait in a file next to the log,
+    // they are appended in frame order at the end.
+    FILE *spill;
+    std::string spillPath;
+};
+
+struct VMAF
+{
+    AVS_Clip *distorted;
+    std::string logPath;
+    VmafOutputFormat logFormat;
+    int logStream;
+    FILE *log;
+    std::mutex logMutex;
+    std::chrono::steady_clock::time_point logSynced;
+    int logLag;
+    std::vector<VmafModel *> model;
+    std::vector<const char *> modelN;
+    std::vector<int> modelIndex;
+    std::vector<VmafModelCollection *> modelCollection;
+    std::vector<const char *> modelCollectionN;
+    // The models loaded as a collection, their features come from the collection.
+    std::vector<bool> modelInCollection;
+    std::vector<int> feature;
+    std::vector<const char *> featureN;
+    std::vector<std::pair<std::string, std::string>> cambiOpt;
+    std::vector<std::unique_ptr<VMAFShard>> shards;
+    int subsample;
+    int step;
+    bool keyframes;
+    bool sparse;
+    // The last streamed sample, it is pooled once the next one shows how many frames it stands for.
+    std::vector<double> sampleScore;
+    int sampleN;
+    VmafPixelFormat pixelFormat;
+    bool chroma;
+    const VMAFConvert *convert;
+    VMAFInput refInput;
+    VMAFInput distInput;
+    std::vector<VMAFResizePlane> resize;
+    size_t queueDepth;
+    int lookahead;
+    VmafConfiguration configuration;
+    // threadWeight - without `threads` every context takes its shard's part of the share of the thread budget.
+    // threadsReserved - `threads`. Both are 0 until the rung joins the budget.
+    double threadWeight;
+    int threadsReserved;
+    int numShard;
+    int window;
+    size_t historySize;
+    std::map<int, std::vector<double>> history;
+    std::mutex historyMutex;
+    std::vector<VMAFScorePool> pool;
+    std::vector<std::string> poolMethod;
+    std::string propSuffix;
+    std::shared_ptr<VMAFCache> cache;
+    uint64_t cacheSettings;
+    // cache_path/<settings hash>.vmafcache, opened by vmaf_start (empty without cache_path).
+    std::filesystem::path cacheFile;
+    // timing - null when off (shared by the rungs), timingLog - the summary is written at the end of the log.
+    VMAFTiming *timing;
+    bool timingLog;
+    // The models are loaded and the contexts are created on the first frame request (vmaf_start).
+    bool started;
+    std::string startError;
+};
+
+// The reference is fetched once for all the distorted clips (rungs), each one has its own contexts and log.
+struct VMAFLadder
+{
+    std::vector<std::unique_ptr<VMAF>> rungs;
+    std::unique_ptr<VMAFTiming> timing;
+    bool timingProps;
+    std::once_flag started;
+    const char *startError;
+};
+
+// Per-frame scores written by the features (the same order as featureName).
+static constexpr const char *featureScoreName[][4] = {
+    {"psnr_y", "psnr_cb", "psnr_cr"},
+    {"psnr_hvs_y", "psnr_hvs_cb", "psnr_hvs_cr", "psnr_hvs"},
+    {"float_ssim"},
+    {"float_ms_ssim"},
+    {"ciede2000"},
+    {"cambi"}};
+
+// Per-frame scores written by the feature extractors of the VMAF models.
+static constexpr const char *modelFeatureScoreName[] = {
+    "integer_adm2", "integer_adm_scale0", "integer_adm_scale1", "integer_adm_scale2", "integer_adm_scale3",
+    "integer_adm2_egl_1", "integer_adm_scale0_egl_1", "integer_adm_scale1_egl_1", "integer_adm_scale2_egl_1", "integer_adm_scale3_egl_1",
+    "integer_motion2", "integer_motion",
+    "integer_vif_scale0", "integer_vif_scale1", "integer_vif_scale2", "integer_vif_scale3",
+    "integer_vif_scale0_egl_1", "integer_vif_scale1_egl_1", "integer_vif_scale2_egl_1", "integer_vif_scale3_egl_1"};
+
+static constexpr const char *modelCollectionScoreSuffix[] = {"_bagging", "_stddev", "_ci_p95_lo", "_ci_p95_hi"};
+
+// 64-bit hash, four independent lanes of 8 bytes (the rounds of xxHash64).
+static uint64_t vmaf_hash(uint64_t seed, const uint8_t *data, size_t size)
+{
+    constexpr uint64_t prime1 = 0x9E3779B185EBCA87ull;
+    constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+    constexpr uint64_t prime3 = 0x165667B19E3779F9ull;
+
+    auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    auto round = [&](uint64_t acc, uint64_t input) { return rotl(acc + input * prime2, 31) * prime1; };
+
+    uint64_t lane[4] = {seed + prime1 + prime2, seed + prime2, seed, seed - prime1};
+    size_t i = 0;
+
+    for (; i + 32 <= size; i += 32)
+    {
+        for (int j = 0; j < 4; ++j)
+        {
+            uint64_t v;
+            memcpy(&v, data + i + j * 8, 8);
+            lane[j] = round(lane[j], v);
+        }
+    }
+
+    uint64_t h = rotl(lane[0], 1) + rotl(lane[1], 7) + rotl(lane[2], 12) + rotl(lane[3], 18) + size;
+
+    for (; i < size; i += 8)
+    {
+        uint64_t v = 0;
+        memcpy(&v, data + i, std::min<size_t>(size - i, 8));
+        h = rotl(h ^ round(0, v), 27) * prime1 + prime3;
+    }
+
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+// Hash of the planes the pictures get (the luma of RGB depends on every plane).
+static uint64_t vmaf_hash_frame(VMAF *d, AVS_VideoFrame *frame, const VMAFInput &input)
+{
+    const int pl[3] = {AVS_PLANAR_Y, AVS_PLANAR_U, AVS_PLANAR_V};
+    const int rgb[3] = {AVS_PLANAR_R, AVS_PLANAR_G, AVS_PLANAR_B};
+    uint64_t h = 0;
+
+    for (int plane = 0; plane < ((d->chroma || input.rgb) ? 3 : 1); ++plane)
+    {
+        const int avsPlane = (input.rgb) ? rgb[plane] : pl[plane];
+        const uint8_t *srcp = avs_get_read_ptr_p(frame, avsPlane);
+        const int pitch = avs_get_pitch_p(frame, avsPlane);
+        const int rowsize = avs_get_row_size_p(frame, avsPlane);
+        const int height = avs_get_height_p(frame, avsPlane);
+
+        for (int y = 0; y < height; ++y)
+            h = vmaf_hash(h, srcp + static_cast<size_t>(y) * pitch, rowsize);
+    }
+
+    return h;
+}
+
+// Opens (or creates) the cache file of the settings, the file of a previous run is loaded.
+static std::shared_ptr<VMAFCache> vmaf_open_cache(const std::filesystem::path &path, size_t numScore)
+{
+    static std::mutex cachesMutex;
+    static std::map<std::filesystem::path, std::weak_ptr<VMAFCache>> caches;
+
+    std::lock_guard<std::mutex> lock(cachesMutex);
+
+    if (auto cache = caches[path].lock())
+        return cache;
+
+    auto cache = std::make_shared<VMAFCache>();
+    cache->numScore = numScore;
+
+    const size_t recordSize = sizeof(uint64_t) + sizeof(double) * numScore;
+    std::error_code ec;
+    const uintmax_t fileSize = std::filesystem::file_size(path, ec);
+
+    if (!ec)
+    {
+        // A record cut short by a crash is dropped, the new records must start at a record border.
+        if (fileSize % recordSize)
+            std::filesystem::resize_file(path, fileSize - fileSize % recordSize, ec);
+
+        if (FILE *file = fopen(path.string().c_str(), "rb"))
+        {
+            std::vector<uint8_t> record(recordSize);
+
+            while (fread(record.data(), recordSize, 1, file) == 1)
+            {
+                uint64_t key;
+                std::vector<double> score(numScore);
+
+                memcpy(&key, record.data(), sizeof(key));
+                memcpy(score.data(), record.data() + sizeof(key), sizeof(double) * numScore);
+                cache->scores.emplace(key, std::move(score));
+            }
+
+            fclose(file);
+        }
+    }
+
+    cache->file = fopen(path.string().c_str(), "ab");
+    if (!cache->file)
+        return nullptr;
+
+    caches[path] = cache;
+
+    return cache;
+}
+
+static const char *vmaf_init_context(const AVS_VideoInfo *vi, VMAF *d, VmafContext **vmaf, bool *picturePool)
+{
+    VMAFStageTimer timer(d->timing, VMAF_STAGE_INIT);
+
+    VmafConfiguration configuration = d->configuration;
+
+    if (d->threadWeight > 0.0)
+        configuration.n_threads = std::max(vmaf_budget_share(d->threadWeight) / d->numShard, 1);
+
+    if (vmaf_init(vmaf, configuration))
+        return "VMAF:failed to initialize VMAF context.";
+
+    for (size_t i = 0; i < d->model.size(); ++i)
+    {
+        if (!d->modelInCollection[i] && vmaf_use_features_from_model(*vmaf, d->model[i]))
+            return "VMAF: failed to load feature extractors from model.";
+    }
+
+    for (auto &&m : d->modelCollection)
+    {
+        if (vmaf_use_features_from_model_collection(*vmaf, m))
+            return "VMAF: failed to load feature extractors from model collection.";
+    }
+
+    for (auto &&f : d->feature)
+    {
+        VmafFeatureDictionary *featureDictionary{};
+
+        if (f == 5)
+        {
+            for (auto &&[name, value] : d->cambiOpt)
+            {
+                if (vmaf_feature_dictionary_set(&featureDictionary, name.c_str(), value.c_str()))
+                {
+                    vmaf_feature_dictionary_free(&featureDictionary);
+                    return "VMAF: failed to set cambi option.";
+                }
+            }
+        }
+
+        if (vmaf_use_feature(*vmaf, featureName[f], featureDictionary))
+        {
+            vmaf_feature_dictionary_free(&featureDictionary);
+            return "VMAF: failed to load feature extractor.";
+        }
+    }
+
+    VmafPictureConfiguration pictureConfiguration{};
+    pictureConfiguration.pic_params.w = vi->width;
+    pictureConfiguration.pic_params.h = vi->height;
+    pictureConfiguration.pic_params.bpc = vmaf_picture_bits(vi);
+    pictureConfiguration.pic_params.pix_fmt = d->pixelFormat;
+    pictureConfiguration.pic_prealloc_method = VMAF_PICTURE_PREALLOCATION_METHOD_HOST;
+
+    // Fall back to per-frame allocation if libvmaf cannot preallocate.
+    *picturePool = !vmaf_preallocate_pictures(*vmaf, pictureConfiguration);
+
+    return 0;
+}
+
+static int vmaf_fetch_pictures(VMAF *d, VmafContext *vmaf, bool picturePool, const AVS_VideoInfo *vi, VmafPicture *ref, VmafPicture *dist)
+{
+    VMAFStageTimer timer(d->timing, VMAF_STAGE_ALLOC);
+
+    // Pictures from the pool go back to it once libvmaf drops its last reference.
+    if (picturePool)
+        return vmaf_fetch_preallocated_picture(vmaf, ref) || vmaf_fetch_preallocated_picture(vmaf, dist);
+
+    vmafPictureAllocations += 2;
+
+    return vmaf_picture_alloc(ref, d->pixelFormat, vmaf_picture_bits(vi), vi->width, vi->height) ||
+           vmaf_picture_alloc(dist, d->pixelFormat, vmaf_picture_bits(vi), vi->width, vi->height);
+}
+
+static const char *vmaf_submit(AVS_FilterInfo *fi, VMAF *d, VmafContext *vmaf, bool picturePool, AVS_VideoFrame *reference, AVS_VideoFrame *distorted, unsigned index)
+{
+    const char *ErrorText = 0;
+    VmafPicture ref{}, dist{};
+
+    if (vmaf_fetch_pictures(d, vmaf, picturePool, &fi->vi, &ref, &dist))
+        ErrorText = "VMAF: failed to allocate picture.";
+
+    if (!ErrorText)
+    {
+        VMAFStageTimer timer(d->timing, VMAF_STAGE_COPY);
+
+        vmaf_write_picture(fi->env, d->convert, &ref, reference, d->refInput, d->chroma);
+        vmaf_write_picture(fi->env, d->convert, &dist, distorted, d->distInput, d->chroma);
+    }
+
+    if (!ErrorText)
+    {
+        VMAFStageTimer timer(d->timing, VMAF_STAGE_READ);
+
+        if (vmaf_read_pictures(vmaf, &ref, &dist, index))
+            ErrorText = "VMAF:failed to read pictures.";
+    }
+
+    vmaf_picture_unref(&ref);
+    vmaf_picture_unref(&dist);
+
+    return ErrorText;
+}
+
+// No more pictures for the context, the scores of its last frames become final.
+static int vmaf_flush(VMAF *d, VmafContext *vmaf)
+{
+    VMAFStageTimer timer(d->timing, VMAF_STAGE_FLUSH);
+
+    return vmaf_read_pictures(vmaf, nullptr, nullptr, 0);
+}
+
+// Reads the model scores followed by the feature scores of the picture `index`.
+// Returns false if they are not all there yet.
+// Computing a model score also stores it, so the callers hold the shard's scoreMutex.
+static bool vmaf_frame_scores(VMAF *d, VmafContext *vmaf, unsigned index, double *score)
+{
+    for (size_t i = 0; i < d->featureN.size(); ++i)
+    {
+        if (vmaf_feature_score_at_index(vmaf, d->featureN[i], &score[d->model.size() + i], index))
+            return false;
+    }
+
+    for (size_t i = 0; i < d->model.size(); ++i)
+    {
+        if (vmaf_score_at_index(vmaf, d->model[i], &score[i], index))
+            return false;
+    }
+
+    return true;
+}
+
+// keyframes - the frame property set by the source filter.
+static bool vmaf_keyframe(AVS_ScriptEnvironment *env, AVS_VideoFrame *frame)
+{
+    int error;
+    const char *pictType = avs_prop_get_data(env, avs_get_frame_props_ro(env, frame), "_PictType", 0, &error);
+
+    return !error && pictType && pictType[0] == 'I';
+}
+
+static void vmaf_sync_log(FILE *log)
+{
+    fflush(log);
+#ifdef _WIN32
+    _commit(_fileno(log));
+#else
+    fsync(fileno(log));
+#endif
+}
+
+// Adds the scores of a frame that stands for `weight` frames of the clip to the pooled scores.
+static void vmaf_pool_score(VMAF *d, const std::vector<double> &score, int weight)
+{
+    for (size_t i = 0; i < score.size(); ++i)
+    {
+        VMAFScorePool &pool = d->pool[i];
+
+        pool.min = (pool.count) ? std::min(pool.min, score[i]) : score[i];
+        pool.max = (pool.count) ? std::max(pool.max, score[i]) : score[i];
+        pool.sum += weight * score[i];
+        pool.harmonicSum += weight / (score[i] + 1.0);
+        pool.count += weight;
+
+        for (auto &&quantile : pool.quantile)
+        {
+            for (int j = 0; j < weight; ++j)
+                quantile.add(score[i]);
+        }
+    }
+}
+
+// Appends the frames up to `last` whose scores are final to the log, the pooled scores and the window history.
+// A frame is final when the models can predict its score (motion needs the next frame) and every feature score is there.
+static const char *vmaf_stream_frames(VMAF *d, VMAFShard *shard, int last, bool flushed)
+{
+    std::vector<double> score(d->model.size() + d->featureN.size());
+    std::lock_guard<std::mutex> scoreLock(shard->scoreMutex);
+
+    // step/keyframes - the frames the submitter hasn't passed yet may still be sampled.
+    for (; shard->written <= std::min(last, (d->sparse) ? shard->decided : shard->end); ++shard->written)
+    {
+        const int n = shard->written;
+
+        if (d->subsample > 1 && n % d->subsample)
+            continue;
+
+        // The last frame of a window is the first (motion only) frame of the next context.
+        const bool retired = shard->retired && n <= shard->base;
+        const auto sample = shard->samples.find(n);
+
+        if (d->sparse && sample == shard->samples.end())
+            continue;
+
+        const unsigned index = (d->sparse) ? sample->second : n - ((retired) ? shard->retiredBase : shard->base);
+
+        if (const auto cached = shard->cached.find(n); cached != shard->cached.end())
+        {
+            score = cached->second;
+            shard->cached.erase(cached);
+        }
+        else if (!vmaf_frame_scores(d, (retired) ? shard->retired : shard->vmaf, index, score.data()))
+            return (flushed) ? "VMAF: failed to get VMAF score." : 0;
+        else if (const auto key = shard->keys.find(n); key != shard->keys.end())
+        {
+            d->cache->add(key->second, score);
+            shard->keys.erase(key);
+        }
+
+        if (d->sparse)
+            shard->samples.erase(sample);
+
+        if (d->window || d->cache || d->sparse)
+        {
+            std::lock_guard<std::mutex> lock(d->historyMutex);
+
+            d->history.emplace(n, score);
+
+            while (d->history.size() > d->historySize)
+                d->history.erase(d->history.begin());
+        }
+
+        std::string record = (d->logStream == 1) ? "{\"frameNum\": " + std::to_string(n) + ", \"metrics\": {" : std::to_string(n);
+
+        for (size_t i = 0; i < score.size(); ++i)
+        {
+            char value[32];
+            snprintf(value, sizeof(value), "%.6f", score[i]);
+
+            const char *name = (i < d->model.size()) ? d->modelN[i] : d->featureN[i - d->model.size()];
+
+            if (d->logStream == 1)
+                record += ((i) ? ", \""s : "\""s) + name + "\": " + value;
+            else
+                record += ","s + value;
+        }
+
+        record += (d->logStream == 1) ? "}}\n" : "\n";
+
+        std::lock_guard<std::mutex> lock(d->logMutex);
+
+        // A sample stands for the frames up to the next sample.
+        if (!d->sparse)
+            vmaf_pool_score(d, score, 1);
+        else
+        {
+            if (d->sampleN >= 0)
+                vmaf_pool_score(d, d->sampleScore, n - d->sampleN);
+
+            d->sampleScore = score;
+            d->sampleN = n;
+        }
+
+        if (fputs(record.c_str(), (shard->spill) ? shard->spill : d->log) < 0)
+            return "VMAF: failed to write VMAF stats.";
+
+        if (const auto now = std::chrono::steady_clock::now(); now - d->logSynced >= 1s)
+        {
+            vmaf_sync_log(d->log);
+            d->logSynced = now;
+        }
+    }
+
+    return 0;
+}
+
+// Appends the records of a shard after the ones of the previous shards.
+static const char *vmaf_append_spill(VMAF *d, VMAFShard *shard)
+{
+    char buffer[65536];
+
+    rewind(shard->spill);
+
+    for (size_t size; (size = fread(buffer, 1, sizeof(buffer), shard->spill)) > 0;)
+    {
+        if (fwrite(buffer, 1, size, d->log) != size)
+            return "VMAF: failed to write VMAF stats.";
+    }
+
+    return (ferror(shard->spill)) ? "VMAF: failed to read the records of a shard." : 0;
+}
+
+static void vmaf_close_spill(VMAFShard *shard)
+{
+    if (!shard->spill)
+        return;
+
+    fclose(shard->spill);
+    shard->spill = nullptr;
+
+    std::error_code ec;
+    std::filesystem::remove(shard->spillPath, ec);
+}
+
+// Only the pooled scores are left to write at the end.
+// They are accumulated while streaming, the frames may no longer be in any libvmaf context.
+static const char *vmaf_stream_pooled(VMAF *d)
+{
+    const size_t numScore = d->model.size() + d->featureN.size();
+    const size_t numMethod = d->poolMethod.size();
+    std::vector<std::string> pooled(numScore * numMethod);
+
+    // The last sample stands for the frames up to the one that would have been sampled next.
+    if (d->sampleN >= 0)
+    {
+        const VMAFShard *shard = d->shards[0].get();
+
+        vmaf_pool_score(d, d->sampleScore, std::min(shard->decided + d->step, shard->end + 1) - d->sampleN);
+        d->sampleN = -1;
+    }
+
+    for (size_t i = 0; i < numScore; ++i)
+    {
+        const VMAFScorePool &pool = d->pool[i];
+
+        if (!pool.count)
+            return "VMAF: failed to generate pooled VMAF score.";
+
+        for (size_t j = 0, k = 0; j < numMethod; ++j)
+        {
+            double score;
+
+            // min/max/mean/harmonic_mean are the same definitions as VmafPoolingMethod.
+            if (d->poolMethod[j] == "min")
+                score = pool.min;
+            else if (d->poolMethod[j] == "max")
+                score = pool.max;
+            else if (d->poolMethod[j] == "mean")
+                score = pool.sum / pool.count;
+            else if (d->poolMethod[j] == "harmonic_mean")
+                score = pool.count / pool.harmonicSum - 1.0;
+            else
+                score = pool.quantile[k++].value();
+
+            char value[32];
+            snprintf(value, sizeof(value), "%.6f", score);
+            pooled[i * numMethod + j] = value;
+        }
+    }
+
+    std::string record;
+
+    if (d->logStream == 1)
+    {
+        record = "{\"pooled_metrics\": {";
+
+        for (size_t i = 0; i < numScore; ++i)
+        {
+            const char *name = (i < d->model.size()) ? d->modelN[i] : d->featureN[i - d->model.size()];
+            record += ((i) ? ", \""s : "\""s) + name + "\": {";
+
+            for (size_t j = 0; j < numMethod; ++j)
+                record += ((j) ? ", \""s : "\""s) + d->poolMethod[j] + "\": " + pooled[i * numMethod + j];
+
+            record += "}";
+        }
+
+        record += "}}\n";
+    }
+    else
+    {
+        // One row per pooling method, named in the frame column.
+        for (size_t j = 0; j < numMethod; ++j)
+        {
+            record += d->poolMethod[j];
+
+            for (size_t i = 0; i < numScore; ++i)
+                record += "," + pooled[i * numMethod + j];
+
+            record += "\n";
+        }
+    }
+
+    if (fputs(record.c_str(), d->log) < 0)
+        return "VMAF: failed to write VMAF stats.";
+
+    vmaf_sync_log(d->log);
+
+    return 0;
+}
+
+// The per-stage durations of the frame requests (ms), after the pooled scores.
+static const char *vmaf_stream_timing(VMAF *d)
+{
+    std::string record = (d->logStream == 1) ? "{\"timing\": {" : "";
+    bool first = true;
+
+    for (int s = 0; s < VMAF_STAGE_COUNT; ++s)
+    {
+        const uint64_t count = d->timing->stage[s].count.load(std::memory_order_relaxed);
+        const double values[] = {
+            (count) ? d->timing->stage[s].sum.load(std::memory_order_relaxed) / 1000.0 / count : 0.0,
+            d->timing->percentile(s, 0.50) / 1000.0,
+            d->timing->percentile(s, 0.95) / 1000.0,
+            d->timing->percentile(s, 0.99) / 1000.0,
+            d->timing->stage[s].max.load(std::memory_order_relaxed) / 1000.0};
+        static constexpr const char *valueName[] = {"mean", "p50", "p95", "p99", "max"};
+
+        if (!count)
+            continue;
+
+        if (d->logStream == 1)
+        {
+            record += ((first) ? "\""s : ", \""s) + stageName[s] + "\": {\"count\": " + std::to_string(count);
+
+            for (int i = 0; i < 5; ++i)
+            {
+                char value[48];
+                snprintf(value, sizeof(value), ", \"%s\": %.3f", valueName[i], values[i]);
+                record += value;
+            }
+
+            record += "}";
+            first = false;
+        }
+        else
+        {
+            // timing_<stage>,count,mean,p50,p95,p99,max - the columns don't follow the header.
+            record += "timing_"s + stageName[s] + "," + std::to_string(count);
+
+            for (int i = 0; i < 5; ++i)
+            {
+                char value[32];
+                snprintf(value, sizeof(value), ",%.3f", values[i]);
+                record += value;
+            }
+
+            record += "\n";
+        }
+    }
+
+    if (d->logStream == 1)
+        record += "}}\n";
+
+    if (fputs(record.c_str(), d->log) < 0)
+        return "VMAF: failed to write VMAF stats.";
+
+    vmaf_sync_log(d->log);
+
+    return 0;
+}
+
+// Finishes the context of the shard (its frames end with n - 1) and starts a new one.
+static const char *vmaf_cache_restart(AVS_FilterInfo *fi, VMAF *d, VMAFShard *shard, int n)
+{
+    if (vmaf_flush(d, shard->vmaf))
+        return "VMAF:failed to flush context.";
+
+    if (const char *ErrorText = vmaf_stream_frames(d, shard, n - 1, true))
+        return ErrorText;
+
+    VmafContext *vmaf = nullptr;
+    bool picturePool;
+
+    if (const char *ErrorText = vmaf_init_context(&fi->vi, d, &vmaf, &picturePool))
+    {
+        if (vmaf)
+            vmaf_close(vmaf);
+
+        return ErrorText;
+    }
+
+    std::lock_guard<std::mutex> lock(shard->scoreMutex);
+
+    vmaf_close(shard->vmaf);
+    shard->vmaf = vmaf;
+    shard->picturePool = picturePool;
+    shard->lastSubmitted = -1;
+
+    return 0;
+}
+
+// Takes the scores of the held frame from the cache or scores it.
+// The scores of a frame depend on the reference frames around it (motion), so they are part of the key.
+// `final` - the next frame never comes, the scores are not the ones of a full run and aren't cached.
+static const char *vmaf_cache_process(AVS_FilterInfo *fi, VMAF *d, VMAFShard *shard, uint64_t nextRef, bool final)
+{
+    const int h = shard->heldN;
+    // Only these frames are streamed (and take their scores from `cached`/`keys`).
+    const bool sampled = h >= shard->begin && h <= shard->end && !(d->subsample > 1 && h % d->subsample);
+
+    const uint64_t key[5] = {d->cacheSettings, shard->previousRef, shard->heldRef, shard->heldDist, nextRef};
+    const uint64_t hash = vmaf_hash(0, reinterpret_cast<const uint8_t *>(key), sizeof(key));
+
+    std::vector<double> score;
+    const bool hit = !final && d->cache->find(hash, score);
+
+    // The frame before still needs this one for its motion score.
+    if (hit && !shard->lastMiss)
+    {
+        std::lock_guard<std::mutex> lock(shard->scoreMutex);
+
+        if (sampled)
+            shard->cached.emplace(h, std::move(score));
+
+        return 0;
+    }
+
+    if (shard->lastSubmitted >= 0 && shard->lastSubmitted != h - 1)
+    {
+        if (const char *ErrorText = vmaf_cache_restart(fi, d, shard, h))
+            return ErrorText;
+    }
+
+    if (shard->lastSubmitted < 0)
+    {
+        // The frame before comes from the cache, the new context gets it for the motion score of this one.
+        if (shard->previous.reference)
+        {
+            if (const char *ErrorText = vmaf_submit(fi, d, shard->vmaf, shard->picturePool, shard->previous.reference, shard->previous.distorted, 0))
+                return ErrorText;
+        }
+
+        std::lock_guard<std::mutex> lock(shard->scoreMutex);
+        shard->base = (shard->previous.reference) ? h - 1 : h;
+    }
+
+    if (const char *ErrorText = vmaf_submit(fi, d, shard->vmaf, shard->picturePool, shard->held.reference, shard->held.distorted, h - shard->base))
+        return ErrorText;
+
+    shard->lastSubmitted = h;
+    shard->lastMiss = !hit;
+
+    std::lock_guard<std::mutex> lock(shard->scoreMutex);
+
+    if (sampled && hit)
+        shard->cached.emplace(h, std::move(score));
+    else if (sampled && !final)
+        shard->keys.emplace(h, hash);
+
+    return 0;
+}
+
+// The held frame becomes the previous one.
+static void vmaf_cache_shift(VMAFShard *shard)
+{
+    if (shard->previous.reference)
+    {
+        avs_release_video_frame(shard->previous.reference);
+        avs_release_video_frame(shard->previous.distorted);
+    }
+
+    shard->previous = shard->held;
+    shard->previousRef = shard->heldRef;
+    shard->held = VMAFQueued{};
+}
+
+// cache_path - frame n is held until the next one, the one held before is scored now.
+static const char *vmaf_cache_frame(AVS_FilterInfo *fi, VMAF *d, VMAFShard *shard, AVS_VideoFrame *reference, AVS_VideoFrame *distorted, int n)
+{
+    const char *ErrorText = 0;
+    const uint64_t ref = vmaf_hash_frame(d, reference, d->refInput);
+
+    if (shard->held.reference)
+    {
+        ErrorText = vmaf_cache_process(fi, d, shard, ref, false);
+        vmaf_cache_shift(shard);
+    }
+
+    shard->held = VMAFQueued{avs_copy_video_frame(reference), avs_copy_video_frame(distorted)};
+    shard->heldN = n;
+    shard->heldRef = ref;
+    shard->heldDist = vmaf_hash_frame(d, distorted, d->distInput);
+
+    // Nothing follows the last frame.
+    if (!ErrorText && n == shard->last)
+    {
+        ErrorText = vmaf_cache_process(fi, d, shard, 0, false);
+        vmaf_cache_shift(shard);
+
+        if (!ErrorText)
+        {
+            if (vmaf_flush(d, shard->vmaf))
+                ErrorText = "VMAF:failed to flush context.";
+            else
+                shard->flushed = true;
+        }
+    }
+
+    return ErrorText;
+}
+
+// step/keyframes - only the sampled frames go to the context, at consecutive indexes.
+// The frames in between are never fetched, so motion is measured between neighbouring samples.
+// `distorted` is null for the frames that aren't keyframes.
+static const char *vmaf_submit_sample(AVS_FilterInfo *fi, VMAF *d, VMAFShard *shard, AVS_VideoFrame *reference, AVS_VideoFrame *distorted, int n)
+{
+    if (distorted)
+    {
+        if (const char *ErrorText = vmaf_submit(fi, d, shard->vmaf, shard->picturePool, reference, distorted, shard->numSamples))
+            return ErrorText;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(shard->scoreMutex);
+
+        if (distorted)
+            shard->samples.emplace(n, shard->numSamples++);
+
+        shard->decided = n;
+    }
+
+    if (n == shard->last)
+    {
+        if (shard->numSamples && vmaf_flush(d, shard->vmaf))
+            return "VMAF:failed to flush context.";
+
+        shard->flushed = true;
+    }
+
+    return 0;
+}
+
+// Scores frame n in the context of the shard.
+// In window mode the last frame of a window also starts the context of the next window,
+// and the first frame of the next window is the last one the previous context gets.
+static const char *vmaf_submit_frame(AVS_FilterInfo *fi, VMAF *d, VMAFShard *shard, AVS_VideoFrame *reference, AVS_VideoFrame *distorted, int n)
+{
+    if (d->cache)
+        return vmaf_cache_frame(fi, d, shard, reference, distorted, n);
+    if (d->sparse)
+        return vmaf_submit_sample(fi, d, shard, reference, distorted, n);
+
+    const char *ErrorText = 0;
+
+    if (shard->retired)
+    {
+        ErrorText = vmaf_submit(fi, d, shard->retired, shard->retiredPicturePool, reference, distorted, n - shard->retiredBase);
+
+        if (!ErrorText && vmaf_flush(d, shard->retired))
+            ErrorText = "VMAF:failed to flush context.";
+        if (!ErrorText && d->log)
+            ErrorText = vmaf_stream_frames(d, shard, shard->base, true);
+
+        std::lock_guard<std::mutex> lock(shard->scoreMutex);
+
+        vmaf_close(shard->retired);
+        shard->retired = nullptr;
+    }
+
+    if (!ErrorText)
+        ErrorText = vmaf_submit(fi, d, shard->vmaf, shard->picturePool, reference, distorted, n - shard->base);
+
+    if (ErrorText)
+        return ErrorText;
+
+    // Nothing follows the last frame, so its scores can be made final right away.
+    if (n == shard->last)
+    {
+        if (vmaf_flush(d, shard->vmaf))
+            return "VMAF:failed to flush context.";
+
+        shard->flushed = true;
+    }
+    else if (d->window && n < shard->end && (n - shard->begin + 1) % d->window == 0)
+    {
+        VmafContext *vmaf = nullptr;
+        bool picturePool;
+
+        ErrorText = vmaf_init_context(&fi->vi, d, &vmaf, &picturePool);
+
+        if (!ErrorText)
+            ErrorText = vmaf_submit(fi, d, vmaf, picturePool, reference, distorted, 0);
+
+        if (ErrorText)
+        {
+            if (vmaf)
+                vmaf_close(vmaf);
+
+            return ErrorText;
+        }
+
+        std::lock_guard<std::mutex> lock(shard->scoreMutex);
+
+        shard->retired = shard->vmaf;
+        shard->retiredPicturePool = shard->picturePool;
+        shard->retiredBase = shard->base;
+        shard->vmaf = vmaf;
+        shard->picturePool = picturePool;
+        shard->base = n;
+    }
+
+    return 0;
+}
+
+static void vmaf_release_queued(const VMAFQueued &f)
+{
+    if (f.reference)
+    {
+        avs_release_video_frame(f.reference);
+        avs_release_video_frame(f.distorted);
+    }
+}
+
+// Wakes the threads waiting for scores.
+static void vmaf_scores_changed(VMAFShard *shard)
+{
+    {
+        std::lock_guard<std::mutex> lock(shard->scoreMutex);
+        ++shard->scoreVersion;
+    }
+
+    shard->scoreCond.notify_all();
+}
+
+// Waits until the scores may have changed since `version`.
+// libvmaf signals nothing when its worker threads finish a frame, with them the scores are checked again after 1 ms at the latest.
+static void vmaf_wait_scores(VMAF *d, VMAFShard *shard, uint64_t version)
+{
+    std::unique_lock<std::mutex> lock(shard->scoreMutex);
+
+    const auto changed = [shard, version] { return shard->scoreVersion != version; };
+
+    if (d->configuration.n_threads || d->threadWeight > 0.0)
+        shard->scoreCond.wait_for(lock, 1ms, changed);
+    else
+        shard->scoreCond.wait(lock, changed);
+}
+
+static void vmaf_submit_thread(AVS_FilterInfo *fi, VMAF *d, VMAFShard *shard)
+{
+    std::unique_lock<std::mutex> lock(shard->queueMutex);
+
+    while (true)
+    {
+        shard->queueCond.wait(lock, [shard] { return (!shard->pending.empty() && shard->pending.begin()->first == shard->next) || shard->stop; });
+
+        // Frames already queued in order are still submitted when stopping.
+        if (shard->pending.empty() || shard->pending.begin()->first != shard->next)
+            break;
+
+        const int n = shard->next;
+        shard->next += d->step;
+        const VMAFQueued f = shard->pending.begin()->second;
+        shard->pending.erase(shard->pending.begin());
+
+        const bool failed = shard->error;
+
+        lock.unlock();
+        shard->queueCond.notify_all();
+
+        const char *ErrorText = (failed) ? 0 : vmaf_submit_frame(fi, d, shard, f.reference, f.distorted, n);
+
+        if (!ErrorText && !failed && d->log)
+            ErrorText = vmaf_stream_frames(d, shard, n - d->logLag, false);
+
+        vmaf_release_queued(f);
+
+        lock.lock();
+
+        shard->submitted = n + d->step;
+
+        if (ErrorText && !shard->error)
+            shard->error = ErrorText;
+
+        shard->queueCond.notify_all();
+        vmaf_scores_changed(shard);
+    }
+}
+
+// libvmaf needs the frames in order (motion depends on the previous frame),
+// so frames arriving from several threads wait in `pending` until it is their turn.
+// Returns once the frames up to `through` are submitted too (-1 - no such requirement).
+static const char *vmaf_queue(AVS_FilterInfo *fi, VMAF *d, VMAFShard *shard, int n, AVS_VideoFrame *reference, AVS_VideoFrame *distorted, int through)
+{
+    std::unique_lock<std::mutex> lock(shard->queueMutex);
+
+    // A frame requested again (e.g. after a cache miss) is not scored twice.
+    if (n >= shard->next && !shard->pending.count(n))
+        shard->pending.emplace(n, (distorted) ? VMAFQueued{avs_copy_video_frame(reference), avs_copy_video_frame(distorted)} : VMAFQueued{});
+
+    // The next frame isn't queued and the buffer can't drain or `through` can't be reached without it.
+    const auto missing = [d, shard, through]
+    {
+        return (shard->pending.empty() || shard->pending.begin()->first != shard->next) && (shard->pending.size() > d->queueDepth || shard->next <= through);
+    };
+
+    while (!shard->error && (shard->pending.size() > d->queueDepth || shard->submitted <= through))
+    {
+        if (!missing())
+        {
+            if (d->queueDepth)
+            {
+                VMAFStageTimer timer(d->timing, VMAF_STAGE_WAIT);
+
+                shard->queueCond.notify_all();
+                shard->queueCond.wait(lock, [d, shard, through, &missing] { return (shard->pending.size() <= d->queueDepth && shard->submitted > through) || missing() || shard->error; });
+            }
+            else
+            {
+                const VMAFQueued f = shard->pending.begin()->second;
+                shard->pending.erase(shard->pending.begin());
+
+                const int n = shard->next;
+                shard->next += d->step;
+                shard->error = vmaf_submit_frame(fi, d, shard, f.reference, f.distorted, n);
+
+                if (!shard->error && d->log)
+                    shard->error = vmaf_stream_frames(d, shard, n - d->logLag, false);
+
+                shard->submitted = shard->next;
+                vmaf_release_queued(f);
+                vmaf_scores_changed(shard);
+            }
+        }
+        else
+        {
+            // Nobody has asked for the next frame yet (seeking or a wide prefetch) - fetch it here so the buffer can drain.
+            // If another thread is already fetching it, AviSynth's cache serves both requests.
+            const int m = shard->next;
+            lock.unlock();
+
+            VMAFStageTimer timer(d->timing, VMAF_STAGE_FETCH, m);
+
+            AVS_VideoFrame *ref = avs_get_frame(fi->child, m);
+            const bool sampled = ref && (!d->keyframes || vmaf_keyframe(fi->env, ref));
+            AVS_VideoFrame *dist = (sampled) ? avs_get_frame(d->distorted, m) : 0;
+
+            timer.stop();
+
+            lock.lock();
+
+            if (!ref || (sampled && !dist))
+            {
+                if (ref)
+                    avs_release_video_frame(ref);
+
+                return (shard->error) ? shard->error : "VMAF: failed to get frame.";
+            }
+
+            // keyframes - the other frames are queued empty, only to be passed over.
+            const VMAFQueued f = (sampled) ? VMAFQueued{ref, dist} : VMAFQueued{};
+
+            if (!sampled)
+                avs_release_video_frame(ref);
+
+            if (m < shard->next || shard->pending.count(m))
+                vmaf_release_queued(f);
+            else
+                shard->pending.emplace(m, f);
+        }
+    }
+
+    lock.unlock();
+    shard->queueCond.notify_all();
+
+    return shard->error;
+}
+
+// Waits until the worker threads are done with frame n and attaches its scores to the frame.
+static const char *vmaf_set_frame_props(AVS_FilterInfo *fi, VMAF *d, VMAFShard *shard, int n, AVS_VideoFrame *frame)
+{
+    std::vector<double> score(d->model.size() + d->featureN.size());
+
+    while (true)
+    {
+        const bool flushed = shard->flushed;
+        uint64_t version;
+
+        {
+            std::lock_guard<std::mutex> lock(shard->scoreMutex);
+
+            if (vmaf_frame_scores(d, shard->vmaf, n - shard->base, score.data()))
+                break;
+
+            version = shard->scoreVersion;
+        }
+
+        if (flushed)
+            return "VMAF: failed to get VMAF score.";
+
+        {
+            std::lock_guard<std::mutex> lock(shard->queueMutex);
+
+            if (shard->error)
+                return shard->error;
+        }
+
+        vmaf_wait_scores(d, shard, version);
+    }
+
+    AVS_Map *props = avs_get_frame_props_rw(fi->env, frame);
+
+    for (size_t i = 0; i < score.size(); ++i)
+        avs_prop_set_float(fi->env, props, (((i < d->model.size()) ? d->modelN[i] : d->featureN[i - d->model.size()]) + d->propSuffix).c_str(), score[i], 0);
+
+    return 0;
+}
+
+// Window and cache mode - the scores come from the history, the contexts holding them may be closed already.
+static const char *vmaf_set_history_props(AVS_FilterInfo *fi, VMAF *d, VMAFShard *shard, int n, AVS_VideoFrame *frame)
+{
+    while (true)
+    {
+        const bool flushed = shard->flushed;
+        uint64_t version;
+
+        {
+            std::lock_guard<std::mutex> lock(shard->scoreMutex);
+            version = shard->scoreVersion;
+        }
+
+        if (const char *ErrorText = vmaf_stream_frames(d, shard, n, false))
+            return ErrorText;
+
+        {
+            std::lock_guard<std::mutex> lock(shard->scoreMutex);
+
+            if (shard->written > n)
+                break;
+        }
+
+        if (flushed)
+            return "VMAF: failed to get VMAF score.";
+
+        {
+            std::lock_guard<std::mutex> lock(shard->queueMutex);
+
+            if (shard->error)
+                return shard->error;
+        }
+
+        vmaf_wait_scores(d, shard, version);
+    }
+
+    std::lock_guard<std::mutex> lock(d->historyMutex);
+
+    // Requested again after it left the history (a seek back, a cache miss of AviSynth), the props cannot be set.
+    const auto frame_score = d->history.find(n);
+    if (frame_score == d->history.end())
+        return "VMAF: the frame is no longer in the score history (requested again too late).";
+
+    std::vector<double> window(frame_score->second.size());
+    int count = 0;
+
+    for (auto it = d->history.lower_bound(n - d->window + 1); d->window && it != std::next(frame_score); ++it, ++count)
+    {
+        for (size_t i = 0; i < window.size(); ++i)
+            window[i] += it->second[i];
+    }
+
+    AVS_Map *props = avs_get_frame_props_rw(fi->env, frame);
+
+    for (size_t i = 0; i < window.size(); ++i)
+    {
+        const std::string name = (i < d->model.size()) ? d->modelN[i] : d->featureN[i - d->model.size()];
+
+        avs_prop_set_float(fi->env, props, (name + d->propSuffix).c_str(), frame_score->second[i], 0);
+
+        if (d->window)
+            avs_prop_set_float(fi->env, props, (name + "_window" + d->propSuffix).c_str(), window[i] / count, 0);
+    }
+
+    return 0;
+}
+
+// Opens the streamed log (truncating it) and the record files of the shards after the first one.
+static const char *vmaf_open_log(VMAF *d)
+{
+    d->logSynced = std::chrono::steady_clock::now();
+    d->log = fopen(d->logPath.c_str(), "w");
+
+    if (!d->log)
+        return "VMAF: cannot open log_path.";
+
+    if (d->logStream == 2)
+    {
+        std::string header = "Frame";
+
+        for (auto &&name : d->modelN)
+            header += ","s + name;
+        for (auto &&name : d->featureN)
+            header += ","s + name;
+
+        fputs((header + "\n").c_str(), d->log);
+    }
+
+    for (size_t i = 1; i < d->shards.size(); ++i)
+    {
+        VMAFShard *shard = d->shards[i].get();
+        shard->spillPath = d->logPath + ".shard" + std::to_string(i);
+        shard->spill = fopen(shard->spillPath.c_str(), "w+b");
+
+        if (!shard->spill)
+            return "VMAF: cannot create the record file of a shard next to log_path.";
+    }
+
+    return 0;
+}
+
+// Opens the log and the cache, loads the models, creates the contexts and starts the submitter threads.
+// Deferred to the first frame request, opening a script only validates the arguments.
+static const char *vmaf_start(AVS_FilterInfo *fi, VMAF *d)
 {
-    AVS_Clip *distorted;
-    std::string logPath;
-    VmafOutputFormat logFormat;
-    std::vector<VmafModel *> model;
-    std::vector<VmafModelCollection *> modelCollection;
-    VmafContext *vmaf;
-    VmafPixelFormat pixelFormat;
-    bool chroma;
-};
+    if (!d->cacheFile.empty())
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(d->cacheFile.parent_path(), ec);
+
+        d->cache = vmaf_open_cache(d->cacheFile, d->model.size() + d->featureN.size());
+
+        if (!d->cache)
+            return "VMAF: cannot open cache_path.";
+    }
+
+    if (d->logStream)
+    {
+        if (const char *ErrorText = vmaf_open_log(d))
+            return ErrorText;
+    }
+
+    for (size_t i = 0; i < d->model.size(); ++i)
+    {
+        VmafModelConfig modelConfig{};
+        modelConfig.name = modelName[d->modelIndex[i]];
+        modelConfig.flags = VMAF_MODEL_FLAGS_DEFAULT;
+
+        if (vmaf_model_load(&d->model[i], &modelConfig, modelVersion[d->modelIndex[i]]))
+        {
+            d->modelCollection.resize(d->modelCollection.size() + 1);
+            d->modelCollectionN.emplace_back(modelName[d->modelIndex[i]]);
+            d->modelInCollection[i] = true;
+
+            if (vmaf_model_collection_load(&d->model[i], &d->modelCollection[d->modelCollection.size() - 1], &modelConfig, modelVersion[d->modelIndex[i]]))
+            {
+                d->startError = "VMAF: failed to load model: "s + modelVersion[d->modelIndex[i]];
+                return d->startError.c_str();
+            }
+        }
+    }
+
+    for (auto &&shard : d->shards)
+    {
+        if (const char *ErrorText = vmaf_init_context(&fi->vi, d, &shard->vmaf, &shard->picturePool))
+            return ErrorText;
+    }
+
+    if (d->queueDepth)
+    {
+        for (auto &&shard : d->shards)
+            shard->submitter = std::thread(vmaf_submit_thread, fi, d, shard.get());
+    }
+
+    d->started = true;
+
+    return 0;
+}
 
 AVS_VideoFrame *AVSC_CC vmaf_get_frame(AVS_FilterInfo *fi, int n)
 {
     const char *ErrorText = 0;
-    VMAF *d = reinterpret_cast<VMAF *>(fi->user_data);
+    VMAFLadder *ladder = reinterpret_cast<VMAFLadder *>(fi->user_data);
+    VMAFFrameTimer frameTimer(ladder->timing.get(), n);
+
+    std::call_once(ladder->started, [&]() {
+        for (auto &&d : ladder->rungs)
+        {
+            if (!ladder->startError)
+                ladder->startError = vmaf_start(fi, d.get());
+        }
+    });
+
+    if (ladder->startError)
+    {
+        fi->error = ladder->startError;
+
+        return 0;
+    }
+
+    VMAFStageTimer fetchTimer(ladder->timing.get(), VMAF_STAGE_FETCH, n);
 
     AVS_VideoFrame *reference = avs_get_frame(fi->child, n);
     if (!reference)
         return nullptr;
 
-    AVS_VideoFrame *distorted = avs_get_frame(d->distorted, n);
-    if (!distorted)
-        return nullptr;
+    fetchTimer.stop();
 
-    VmafPicture ref{}, dist{};
+    for (auto &&d : ladder->rungs)
+    {
+        // The distorted frames outside start..end and between the samples are never requested.
+        if (std::none_of(d->shards.begin(), d->shards.end(), [&](auto &&shard) { return n >= shard->first && n <= shard->last && (n - shard->first) % d->step == 0; }))
+            continue;
 
-    if (vmaf_picture_alloc(&ref, d->pixelFormat, avs_bits_per_component(&fi->vi), fi->vi.width, fi->vi.height) ||
-        vmaf_picture_alloc(&dist, d->pixelFormat, avs_bits_per_component(&fi->vi), fi->vi.width, fi->vi.height))
-        ErrorText = "VMAF: failed to allocate picture.";
+        AVS_VideoFrame *distorted = nullptr;
 
-    const int pl[3] = {AVS_PLANAR_Y, AVS_PLANAR_U, AVS_PLANAR_V};
-    const int planecount = std::min(avs_num_components(&fi->vi), 3);
-    for (int plane = 0; plane < planecount; ++plane)
-    {
-        if (plane && !d->chroma)
-            break;
+        if (!d->keyframes || vmaf_keyframe(fi->env, reference))
+        {
+            VMAFStageTimer timer(d->timing, VMAF_STAGE_FETCH, n);
+
+            distorted = avs_get_frame(d->distorted, n);
+            if (!distorted)
+            {
+                avs_release_video_frame(reference);
+                return nullptr;
+            }
+        }
 
-        avs_bit_blt(fi->env, reinterpret_cast<uint8_t *>(ref.data[plane]),
-                    ref.stride[plane],
-                    avs_get_read_ptr_p(reference, pl[plane]),
-                    avs_get_pitch_p(reference, pl[plane]),
-                    avs_get_row_size_p(reference, pl[plane]),
-                    avs_get_height_p(reference, pl[plane]));
+        // Frames at a shard border go to both neighbouring shards.
+        for (auto &&shard : d->shards)
+        {
+            if (ErrorText || n < shard->first || n > shard->last)
+                continue;
 
-        avs_bit_blt(fi->env, reinterpret_cast<uint8_t *>(dist.data[plane]),
-                    dist.stride[plane],
-                    avs_get_read_ptr_p(distorted, pl[plane]),
-                    avs_get_pitch_p(distorted, pl[plane]),
-                    avs_get_row_size_p(distorted, pl[plane]),
-                    avs_get_height_p(distorted, pl[plane]));
-    }
+            // The scores of n are final once the next frame is submitted (motion), the lookahead keeps the worker threads busy meanwhile.
+            // With the cache a frame is submitted only when the one after it comes.
+            const bool props = d->lookahead && distorted && n >= shard->begin && n <= shard->end && !(d->subsample > 1 && n % d->subsample);
 
-    if (!ErrorText && vmaf_read_pictures(d->vmaf, &ref, &dist, n))
-        ErrorText = "VMAF:failed to read pictures.";
+            ErrorText = vmaf_queue(fi, d.get(), shard.get(), n, reference, distorted,
+                (props) ? std::min(n + d->lookahead * d->step + ((d->cache) ? 1 : 0), shard->last) : -1);
 
-    vmaf_picture_unref(&ref);
-    vmaf_picture_unref(&dist);
+            if (!ErrorText && props)
+            {
+                VMAFStageTimer timer(d->timing, VMAF_STAGE_WAIT);
+
+                ErrorText = (d->window || d->cache || d->sparse) ? vmaf_set_history_props(fi, d.get(), shard.get(), n, reference)
+                                                                 : vmaf_set_frame_props(fi, d.get(), shard.get(), n, reference);
+            }
+        }
+
+        if (distorted)
+            avs_release_video_frame(distorted);
+
+        if (ErrorText)
+            break;
+    }
 
     if (ErrorText)
     {
         avs_release_video_frame(reference);
-        avs_release_video_frame(distorted);
 
         fi->error = ErrorText;
 
         return 0;
     }
-    else
+
+    if (ladder->timingProps)
+        frameTimer.set_props(fi->env, reference);
+
+    return reference;
+}
+
+// libvmaf cannot list the scores it collected, so the merged log holds the scores of the models
+// and of the features that the filter knows the names of.
+static const char *vmaf_merge_shards(VMAF *d, VmafContext **merged)
+{
+    VmafConfiguration configuration{};
+    configuration.log_level = VMAF_LOG_LEVEL_INFO;
+    configuration.n_subsample = d->subsample;
+
+    if (vmaf_init(merged, configuration))
+        return "VMAF:failed to initialize VMAF context.";
+
+    std::vector<std::string> scoreName(std::begin(modelFeatureScoreName), std::end(modelFeatureScoreName));
+
+    for (auto &&f : d->feature)
+    {
+        for (auto &&name : featureScoreName[f])
+        {
+            if (name)
+                scoreName.emplace_back(name);
+        }
+    }
+
+    for (auto &&name : d->modelCollectionN)
     {
-        avs_release_video_frame(distorted);
+        for (auto &&suffix : modelCollectionScoreSuffix)
+            scoreName.emplace_back(name + std::string(suffix));
+    }
+
+    for (auto &&shard : d->shards)
+    {
+        for (int n = shard->begin; n <= shard->end; ++n)
+        {
+            if (d->subsample > 1 && n % d->subsample)
+                continue;
 
-        return reference;
+            // Computing the model scores also stores them in the shard context.
+            for (size_t i = 0; i < d->model.size(); ++i)
+            {
+                double score;
+
+                if (vmaf_score_at_index(shard->vmaf, d->model[i], &score, n) ||
+                    vmaf_import_feature_score(*merged, d->modelN[i], n, score))
+                    return "VMAF:failed to merge VMAF model score.";
+            }
+
+            for (auto &&m : d->modelCollection)
+            {
+                if (VmafModelCollectionScore score; vmaf_score_at_index_model_collection(shard->vmaf, m, &score, n))
+                    return "VMAF:failed to merge VMAF model collection score.";
+            }
+
+            for (auto &&name : scoreName)
+            {
+                // Not every listed score is produced by the used models.
+                if (double score; !vmaf_feature_score_at_index(shard->vmaf, name.c_str(), &score, n) &&
+                                  vmaf_import_feature_score(*merged, name.c_str(), n, score))
+                    return "VMAF:failed to merge VMAF feature score.";
+            }
+        }
     }
+
+    return 0;
 }
 
-void AVSC_CC free_vmaf(AVS_FilterInfo *fi)
+// Writes the log of one rung and releases it.
+static const char *vmaf_finish(AVS_FilterInfo *fi, VMAF *d)
 {
     const char *ErrorText = 0;
-    VMAF *d = reinterpret_cast<VMAF *>(fi->user_data);
+
+    // No frame was requested or vmaf_start failed, there are no scores to write.
+    if (!d->started)
+    {
+        avs_release_clip(d->distorted);
+        vmaf_budget_leave(d->threadWeight, d->threadsReserved);
+
+        if (d->log)
+            fclose(d->log);
+
+        for (auto &&shard : d->shards)
+            vmaf_close_spill(shard.get());
+
+        for (auto &&m : d->model)
+            if (m)
+                vmaf_model_destroy(m);
+        for (auto &&m : d->modelCollection)
+            if (m)
+                vmaf_model_collection_destroy(m);
+        for (auto &&shard : d->shards)
+            if (shard->vmaf)
+                vmaf_close(shard->vmaf);
+
+        return 0;
+    }
+
+    for (auto &&shard : d->shards)
+    {
+        if (shard->submitter.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(shard->queueMutex);
+                shard->stop = true;
+            }
+
+            shard->queueCond.notify_all();
+            shard->submitter.join();
+        }
+
+        if (!ErrorText)
+            ErrorText = shard->error;
+
+        for (auto &&[n, f] : shard->pending)
+            vmaf_release_queued(f);
+    }
 
     avs_release_clip(d->distorted);
+    vmaf_budget_leave(d->threadWeight, d->threadsReserved);
 
-    if (vmaf_read_pictures(d->vmaf, nullptr, nullptr, 0))
-        ErrorText = "VMAF:failed to flush context.";
+    for (auto &&shard : d->shards)
+    {
+        // Playback stopped before the frame after the held one.
+        if (!ErrorText && shard->held.reference)
+            ErrorText = vmaf_cache_process(fi, d, shard.get(), 0, true);
+
+        if (shard->held.reference)
+            vmaf_cache_shift(shard.get());
+        if (shard->previous.reference)
+            vmaf_cache_shift(shard.get());
+
+        // The frame that would have made the previous window's scores final never came.
+        if (!ErrorText && shard->retired && vmaf_flush(d, shard->retired))
+            ErrorText = "VMAF:failed to flush context.";
+        if (!ErrorText && shard->retired && d->log)
+            ErrorText = vmaf_stream_frames(d, shard.get(), shard->base, true);
+
+        if (!ErrorText && !shard->flushed && vmaf_flush(d, shard->vmaf))
+            ErrorText = "VMAF:failed to flush context.";
+
+        // Only the submitted frames - playback may have been stopped early.
+        if (!ErrorText && d->log)
+            ErrorText = vmaf_stream_frames(d, shard.get(), std::min(shard->end, shard->next - 1), true);
+    }
 
-    if (!ErrorText)
+    for (auto &&shard : d->shards)
+    {
+        if (!ErrorText && shard->spill)
+            ErrorText = vmaf_append_spill(d, shard.get());
+
+        vmaf_close_spill(shard.get());
+    }
+
+    VmafContext *merged = nullptr;
+
+    if (!ErrorText && !d->log && d->shards.size() > 1)
+        ErrorText = vmaf_merge_shards(d, &merged);
+
+    VmafContext *output = (merged) ? merged : (d->shards.empty()) ? nullptr : d->shards[0]->vmaf;
+
+    if (!ErrorText && !d->log)
     {
         for (auto &&m : d->model)
-            if (double score; vmaf_score_pooled(d->vmaf, m, VMAF_POOL_METHOD_MEAN, &score, 0, fi->vi.num_frames - 1))
+            if (double score; vmaf_score_pooled(output, m, VMAF_POOL_METHOD_MEAN, &score, 0, fi->vi.num_frames - 1))
                 ErrorText = "VMAF:failed to generate pooled VMAF model score.";
     }
 
-    if (!ErrorText)
+    if (!ErrorText && !d->log)
     {
         for (auto &&m : d->modelCollection)
-            if (VmafModelCollectionScore score; vmaf_score_pooled_model_collection(d->vmaf, m, VMAF_POOL_METHOD_MEAN, &score, 0, fi->vi.num_frames - 1))
+            if (VmafModelCollectionScore score; vmaf_score_pooled_model_collection(output, m, VMAF_POOL_METHOD_MEAN, &score, 0, fi->vi.num_frames - 1))
                 ErrorText = "VMAF:failed to generate pooled VMAF model collection score.";
     }
 
     if (!ErrorText)
     {
-        if (vmaf_write_output(d->vmaf, d->logPath.c_str(), d->logFormat))
+        if (d->log)
+            ErrorText = vmaf_stream_pooled(d);
+        else if (vmaf_write_output(output, d->logPath.c_str(), d->logFormat))
             ErrorText = "VMAF: failed to write VMAF stats.";
     }
 
+    if (!ErrorText && d->log && d->timingLog)
+        ErrorText = vmaf_stream_timing(d);
+
+    if (d->log)
+        fclose(d->log);
+
     for (auto &&m : d->model)
         vmaf_model_destroy(m);
     for (auto &&m : d->modelCollection)
         vmaf_model_collection_destroy(m);
-    vmaf_close(d->vmaf);
+    for (auto &&shard : d->shards)
+    {
+        vmaf_close(shard->vmaf);
 
-    delete d;
+        if (shard->retired)
+            vmaf_close(shard->retired);
+    }
+    if (merged)
+        vmaf_close(merged);
 
-    if (ErrorText)
-        std::cout << ErrorText;
+    return ErrorText;
 }
 
-static int AVSC_CC vmaf_set_cache_hints(AVS_FilterInfo *fi, int cachehints, int frame_range)
+void AVSC_CC free_vmaf(AVS_FilterInfo *fi)
 {
-    return cachehints == AVS_CACHE_GET_MTMODE ? 3 : 0;
-}
+    VMAFLadder *d = reinterpret_cast<VMAFLadder *>(fi->user_data);
 
-AVS_Value AVSC_CC Create_VMAF(AVS_ScriptEnvironment *env, AVS_Value args, void *param)
-{
-    AVS_FilterInfo *fi;
+    for (auto &&rung : d->rungs)
+    {
+        if (const char *ErrorText = vmaf_finish(fi, rung.get()))
+            std::cout << ErrorText;
+    }
 
-    AVS_Clip *clip = avs_new_c_filter(env, &fi, avs_array_elt(args, 0), 1);
+    // The submitter threads are stopped, every span is in the buffers.
+    if (d->timing && d->timing->trace && !d->timing->trace->write())
+        std::cout << "VMAF: failed to write trace_path.";
+
+    delete d;
+}
 
-    VMAF *params = new VMAF();
+static int AVSC_CC vmaf_set_cache_hints(AVS_FilterInfo *fi, int cachehints, int frame_range)
+{
+    return cachehints == AVS_CACHE_GET_MTMODE ? 1 : 0;
+}
 
-    params->distorted = avs_take_clip(avs_array_elt(args, 1), env);
-    params->logPath = avs_as_string(avs_array_elt(args, 2));
+// Validates the arguments for one distorted clip and creates its contexts.
+static AVS_Value vmaf_init_rung(AVS_ScriptEnvironment *env, AVS_FilterInfo *fi, AVS_Value args, VMAF *params)
+{
     const int logFormat = (avs_is_int(avs_array_elt(args, 3))) ? avs_as_int(avs_array_elt(args, 3)) : 0;
+    const int queueDepth = (avs_is_int(avs_array_elt(args, 7))) ? avs_as_int(avs_array_elt(args, 7)) : 2;
+    const int threads = (avs_is_int(avs_array_elt(args, 8))) ? avs_as_int(avs_array_elt(args, 8)) : std::thread::hardware_concurrency();
+    const double threadWeight = (avs_is_float(avs_array_elt(args, 24))) ? avs_as_float(avs_array_elt(args, 24)) : 1.0;
+    const int subsample = (avs_is_int(avs_array_elt(args, 9))) ? avs_as_int(avs_array_elt(args, 9)) : 1;
+    const int cpumask = (avs_is_int(avs_array_elt(args, 10))) ? avs_as_int(avs_array_elt(args, 10)) : 0;
+    const int shards = (avs_is_int(avs_array_elt(args, 11))) ? avs_as_int(avs_array_elt(args, 11)) : 1;
+    const int lookahead = (avs_is_int(avs_array_elt(args, 12))) ? avs_as_int(avs_array_elt(args, 12)) : 0;
+    const int window = (avs_is_int(avs_array_elt(args, 13))) ? avs_as_int(avs_array_elt(args, 13)) : 0;
+    const char *pool = (avs_is_string(avs_array_elt(args, 14))) ? avs_as_string(avs_array_elt(args, 14)) : "min max mean harmonic_mean";
+    const std::string matrix = (avs_is_string(avs_array_elt(args, 16))) ? avs_as_string(avs_array_elt(args, 16)) : "rec709";
+    const std::string scale = (avs_is_string(avs_array_elt(args, 17))) ? avs_as_string(avs_array_elt(args, 17)) : "";
+    const int start = (avs_is_int(avs_array_elt(args, 18))) ? avs_as_int(avs_array_elt(args, 18)) : 0;
+    const int end = (avs_is_int(avs_array_elt(args, 19))) ? avs_as_int(avs_array_elt(args, 19)) : fi->vi.num_frames - 1;
+    const int step = (avs_is_int(avs_array_elt(args, 20))) ? avs_as_int(avs_array_elt(args, 20)) : 1;
+    const bool keyframes = (avs_is_bool(avs_array_elt(args, 21))) ? avs_as_bool(avs_array_elt(args, 21)) : false;
+    const int timing = (avs_is_int(avs_array_elt(args, 22))) ? avs_as_int(avs_array_elt(args, 22)) : 0;
+    const bool sparse = step > 1 || keyframes;
 
     std::unique_ptr<int[]> model;
     const int numModel = (avs_defined(avs_array_elt(args, 4))) ? avs_array_size(avs_array_elt(args, 4)) : 0;
@@ -148,52 +1828,154 @@ AVS_Value AVSC_CC Create_VMAF(AVS_ScriptEnvironment *env, AVS_Value args, void *
             model[i] = avs_as_int(*(avs_as_array(avs_array_elt(args, 4)) + i));
 
         params->model.resize(numModel);
+        params->modelN.resize(numModel);
+        params->modelIndex.resize(numModel);
+        params->modelInCollection.resize(numModel);
     }
 
     AVS_Value v = avs_void;
 
-    if (avs_bits_per_component(&fi->vi) > 10)
-        v = avs_new_value_error("VMAF: only 8..10-bit input supported.");
-    if (!avs_defined(v) && avs_is_rgb(&fi->vi))
-        v = avs_new_value_error("VMAF: RGB color family is not supported.");
-    if (!avs_defined(v) && !avs_is_planar(&fi->vi))
+    if (!avs_is_planar(&fi->vi))
         v = avs_new_value_error("VMAF: only planar format supported.");
     if (!avs_defined(v) && avs_num_components(&fi->vi) < 3)
         v = avs_new_value_error("VMAF: minimum three planes are required.");
-
-    const bool is420 = avs_is_420(&fi->vi);
-    const bool is422 = avs_is_422(&fi->vi);
-    const bool is444 = avs_is_444(&fi->vi);
-
-    if (!avs_defined(v) && !(is420 || is422 || is444))
+    if (!avs_defined(v) && !vmaf_is_supported(&fi->vi))
         v = avs_new_value_error("VMAF: only 420/422/444 chroma subsampling is supported.");
 
     if (!avs_defined(v))
     {
         const AVS_VideoInfo *vi1 = avs_get_video_info(params->distorted);
 
-        if (!avs_is_same_colorspace(&fi->vi, vi1))
-            v = avs_new_value_error("VMAF: both clips must be the same format.");
-        if (!avs_defined(v) && fi->vi.width != vi1->width || fi->vi.height != vi1->height)
+        // The chroma subsampling may differ, the clip with the higher chroma resolution is downsampled.
+        if (!vmaf_is_supported(vi1))
+            v = avs_new_value_error("VMAF: distorted must be in YUV 420/422/444 or RGB planar format.");
+        if (!avs_defined(v) && avs_bits_per_component(&fi->vi) != avs_bits_per_component(vi1))
+            v = avs_new_value_error("VMAF: both clips must have the same bit depth.");
+        if (!avs_defined(v) && scale.empty() && (fi->vi.width != vi1->width || fi->vi.height != vi1->height))
             v = avs_new_value_error("VMAF: both clips must have the same dimensions.");
+        if (!avs_defined(v) && !scale.empty() && scale != "bicubic" && scale != "lanczos")
+            v = avs_new_value_error("VMAF: scale must be bicubic or lanczos.");
+        if (!avs_defined(v) && !scale.empty())
+        {
+            // The distorted clip is brought to the chroma subsampling of the pictures before resizing.
+            const VmafPixelFormat pixelFormat = vmaf_picture_format(&fi->vi, vi1);
+
+            if ((pixelFormat != VMAF_PIX_FMT_YUV444P && vi1->width % 2) || (pixelFormat == VMAF_PIX_FMT_YUV420P && vi1->height % 2))
+                v = avs_new_value_error("VMAF: distorted dimensions must be divisible by the chroma subsampling of reference.");
+        }
         if (!avs_defined(v) && fi->vi.num_frames != vi1->num_frames)
             v = avs_new_value_error("VMAF: both clips' number of frames don't match.");
     }
-    if (!avs_defined(v) && (logFormat < 0 || logFormat > 3))
-        v = avs_new_value_error("VMAF: log_fmt must be 0, 1, 2 or 3.");
+    if (!avs_defined(v))
+    {
+        VMAFMatrix coefficients;
+
+        if (!vmaf_get_matrix(matrix, 8, 8, &coefficients))
+            v = avs_new_value_error("VMAF: matrix must be rec601, rec709, rec2020, pc.601, pc.709 or pc.2020.");
+    }
+    if (!avs_defined(v) && (logFormat < 0 || logFormat > 5))
+        v = avs_new_value_error("VMAF: log_format must be 0, 1, 2, 3, 4 or 5.");
+    if (!avs_defined(v) && queueDepth < 0)
+        v = avs_new_value_error("VMAF: queue_depth must be greater than or equal to 0.");
+    if (!avs_defined(v) && threads < 0)
+        v = avs_new_value_error("VMAF: threads must be greater than or equal to 0.");
+    if (!avs_defined(v) && threadWeight <= 0.0)
+        v = avs_new_value_error("VMAF: thread_weight must be greater than 0.");
+    if (!avs_defined(v) && avs_defined(avs_array_elt(args, 8)) && avs_defined(avs_array_elt(args, 24)))
+        v = avs_new_value_error("VMAF: thread_weight cannot be used with threads.");
+    if (!avs_defined(v) && subsample < 1)
+        v = avs_new_value_error("VMAF: subsample must be greater than or equal to 1.");
+    if (!avs_defined(v) && cpumask < 0)
+        v = avs_new_value_error("VMAF: cpumask must be greater than or equal to 0.");
+    if (!avs_defined(v) && (start < 0 || start >= fi->vi.num_frames))
+        v = avs_new_value_error("VMAF: start must be between 0 and the number of frames - 1.");
+    if (!avs_defined(v) && (end < start || end >= fi->vi.num_frames))
+        v = avs_new_value_error("VMAF: end must be between start and the number of frames - 1.");
+    if (!avs_defined(v) && step < 1)
+        v = avs_new_value_error("VMAF: step must be greater than or equal to 1.");
+    if (!avs_defined(v) && (avs_defined(avs_array_elt(args, 18)) || avs_defined(avs_array_elt(args, 19)) || sparse) && logFormat < 4)
+        v = avs_new_value_error("VMAF: start, end, step and keyframes require log_format 4 or 5.");
+    if (!avs_defined(v) && sparse && (subsample > 1 || shards > 1 || window || avs_defined(avs_array_elt(args, 15))))
+        v = avs_new_value_error("VMAF: step and keyframes cannot be used with subsample, shards, window or cache_path.");
+    if (!avs_defined(v) && keyframes && lookahead)
+        v = avs_new_value_error("VMAF: keyframes cannot be used with lookahead.");
+    if (!avs_defined(v) && (shards < 1 || shards > end - start + 1))
+        v = avs_new_value_error("VMAF: shards must be between 1 and the number of frames.");
+    if (!avs_defined(v) && lookahead < 0)
+        v = avs_new_value_error("VMAF: lookahead must be greater than or equal to 0.");
+    if (!avs_defined(v) && window < 0)
+        v = avs_new_value_error("VMAF: window must be greater than or equal to 0.");
+    if (!avs_defined(v) && window && logFormat < 4)
+        v = avs_new_value_error("VMAF: window requires log_format 4 or 5.");
+    if (!avs_defined(v) && window && shards > 1)
+        v = avs_new_value_error("VMAF: window cannot be used with shards.");
+    if (!avs_defined(v) && window && subsample > 1)
+        v = avs_new_value_error("VMAF: window cannot be used with subsample.");
+    if (!avs_defined(v) && avs_defined(avs_array_elt(args, 14)) && logFormat < 4)
+        v = avs_new_value_error("VMAF: pool requires log_format 4 or 5.");
+    if (!avs_defined(v) && avs_defined(avs_array_elt(args, 15)) && logFormat < 4)
+        v = avs_new_value_error("VMAF: cache_path requires log_format 4 or 5.");
+    if (!avs_defined(v) && avs_defined(avs_array_elt(args, 15)) && window)
+        v = avs_new_value_error("VMAF: cache_path cannot be used with window.");
+    if (!avs_defined(v) && avs_defined(avs_array_elt(args, 15)) && subsample > 1)
+        v = avs_new_value_error("VMAF: cache_path cannot be used with subsample.");
+    if (!avs_defined(v) && (timing < 0 || timing > 3))
+        v = avs_new_value_error("VMAF: timing must be between 0 and 3.");
+    if (!avs_defined(v) && (timing & 1) && logFormat < 4)
+        v = avs_new_value_error("VMAF: timing 1 and 3 require log_format 4 or 5.");
+
+    std::vector<double> percentile;
+
+    if (!avs_defined(v))
+    {
+        std::istringstream methods(pool);
+
+        for (std::string method; methods >> method && !avs_defined(v);)
+        {
+            if (std::count(params->poolMethod.begin(), params->poolMethod.end(), method))
+                v = avs_new_value_error("VMAF: duplicate pool specified.");
+            else if (method == "min" || method == "max" || method == "mean" || method == "harmonic_mean")
+                params->poolMethod.emplace_back(method);
+            else
+            {
+                // pN - the N-th percentile.
+                char *end = nullptr;
+                const double p = (method.size() > 1 && method[0] == 'p') ? strtod(method.c_str() + 1, &end) : -1.0;
+
+                if (!end || *end || p <= 0.0 || p >= 100.0)
+                    v = avs_new_value_error("VMAF: pool must be min, max, mean, harmonic_mean or pN (0 < N < 100).");
+                else
+                {
+                    params->poolMethod.emplace_back(method);
+                    percentile.emplace_back(p / 100.0);
+                }
+            }
+        }
+
+        if (!avs_defined(v) && params->poolMethod.empty())
+            v = avs_new_value_error("VMAF: pool must be min, max, mean, harmonic_mean or pN (0 < N < 100).");
+    }
+    if (!avs_defined(v) && (lookahead || window || keyframes || (timing & 2)) && avs_check_version(env, 8))
+        v = avs_new_value_error("VMAF: lookahead, window, keyframes and timing 2 and 3 require AviSynth+ 3.6 or later.");
 
     if (!avs_defined(v))
     {
-        params->logFormat = static_cast<VmafOutputFormat>(logFormat + 1);
+        params->logFormat = static_cast<VmafOutputFormat>(std::min(logFormat + 1, 4));
+        params->logStream = std::max(logFormat - 3, 0);
 
-        VmafConfiguration configuration{};
-        configuration.log_level = VMAF_LOG_LEVEL_INFO;
-        configuration.n_threads = std::thread::hardware_concurrency();
-        configuration.n_subsample = 1;
-        configuration.cpumask = 0;
+        const AVS_VideoInfo *vi1 = avs_get_video_info(params->distorted);
+
+        params->pixelFormat = vmaf_picture_format(&fi->vi, vi1);
+        params->refInput = vmaf_input(&fi->vi, params->pixelFormat, matrix);
+        params->distInput = vmaf_input(vi1, params->pixelFormat, matrix);
 
-        if (vmaf_init(&params->vmaf, configuration))
-            v = avs_new_value_error("VMAF:failed to initialize VMAF context.");
+        // The distorted frames are resized to the pictures (the reference dimensions).
+        if (fi->vi.width != vi1->width || fi->vi.height != vi1->height)
+        {
+            vmaf_init_resize(&params->resize, scale, vi1, fi->vi.width, fi->vi.height, params->pixelFormat);
+            params->distInput.resize = params->resize.data();
+        }
+        params->convert = vmaf_get_convert(avs_get_cpu_flags(env));
     }
 
     if (!avs_defined(v))
@@ -206,28 +1988,12 @@ AVS_Value AVSC_CC Create_VMAF(AVS_ScriptEnvironment *env, AVS_Value args, void *
             if (!avs_defined(v) && std::count(model.get(), model.get() + numModel, model[i]) > 1)
                 v = avs_new_value_error("VMAF: duplicate model specified.");
 
+            // The models are loaded by vmaf_start.
             if (!avs_defined(v))
             {
-                VmafModelConfig modelConfig{};
-                modelConfig.name = modelName[model[i]];
-                modelConfig.flags = VMAF_MODEL_FLAGS_DEFAULT;
-
-                if (vmaf_model_load(&params->model[i], &modelConfig, modelVersion[model[i]]))
-                {
-                    params->modelCollection.resize(params->modelCollection.size() + 1);
-
-                    if (vmaf_model_collection_load(&params->model[i], &params->modelCollection[params->modelCollection.size() - 1], &modelConfig, modelVersion[model[i]]))
-                        v = avs_new_value_error(("VMAF: failed to load model: "s + modelVersion[model[i]]).c_str());
-
-                    if (!avs_defined(v) && vmaf_use_features_from_model_collection(params->vmaf, params->modelCollection[params->modelCollection.size() - 1]))
-                        v = avs_new_value_error(("VMAF: failed to load feature extractors from model collection: "s + modelVersion[model[i]]).c_str());
-
-                    continue;
-                }
+                params->modelN[i] = modelName[model[i]];
+                params->modelIndex[i] = model[i];
             }
-
-            if (!avs_defined(v) && vmaf_use_features_from_model(params->vmaf, params->model[i]))
-                v = avs_new_value_error(("VMAF: failed to load feature extractors from model: "s + modelVersion[model[i]]).c_str());
         }
     }
 
@@ -265,7 +2031,6 @@ AVS_Value AVSC_CC Create_VMAF(AVS_ScriptEnvironment *env, AVS_Value args, void *
 
                     if (!avs_defined(v))
                     {
-                        VmafFeatureDictionary *featureDictionary{};
                         std::vector<int> unique_name;
                         unique_name.reserve(match.size());
 
@@ -404,35 +2169,22 @@ AVS_Value AVSC_CC Create_VMAF(AVS_ScriptEnvironment *env, AVS_Value args, void *
                         if (!avs_defined(v))
                         {
                             for (int i = 1; match[i + 1].matched; i += 2)
-                            {
-                                if (vmaf_feature_dictionary_set(&featureDictionary, match[i].str().c_str(), match[i + 1].str().c_str()))
-                                {
-                                    static const std::string m = "VMAF: failed to set cambi option "s + match[i].str() + "."s;
-                                    v = avs_new_value_error((m).c_str());
-                                    break;
-                                }
-                            }
-                        }
-
-                        if (!avs_defined(v) && vmaf_use_feature(params->vmaf, "cambi", featureDictionary))
-                        {
-                            vmaf_feature_dictionary_free(&featureDictionary);
-                            v = avs_new_value_error("VMAF: failed to load feature extractor: cambi.");
+                                params->cambiOpt.emplace_back(match[i].str(), match[i + 1].str());
                         }
                     }
                 }
-                else
-                {
-                    if (vmaf_use_feature(params->vmaf, "cambi", nullptr))
-                        v = avs_new_value_error("VMAF: failed to load feature extractor: cambi.");
-                }
             }
 
-            if (!avs_defined(v) && feature[i] != 5 && vmaf_use_feature(params->vmaf, featureName[feature[i]], nullptr))
-                v = avs_new_value_error(("VMAF: failed to load feature extractor: "s + featureName[feature[i]]).c_str());
-
             if (!avs_defined(v))
             {
+                params->feature.emplace_back(feature[i]);
+
+                for (auto &&name : featureScoreName[feature[i]])
+                {
+                    if (name)
+                        params->featureN.emplace_back(name);
+                }
+
                 if (!std::strcmp(featureName[feature[i]], "psnr") ||
                     !std::strcmp(featureName[feature[i]], "psnr_hvs") ||
                     !std::strcmp(featureName[feature[i]], "ciede"))
@@ -443,16 +2195,143 @@ AVS_Value AVSC_CC Create_VMAF(AVS_ScriptEnvironment *env, AVS_Value args, void *
 
     if (!avs_defined(v))
     {
-        if (is420)
-            params->pixelFormat = VMAF_PIX_FMT_YUV420P;
-        else if (is422)
-            params->pixelFormat = VMAF_PIX_FMT_YUV422P;
+        params->queueDepth = queueDepth;
+        params->subsample = subsample;
+        params->step = step;
+        params->keyframes = keyframes;
+        params->sparse = sparse;
+        params->timingLog = timing & 1;
+        params->sampleN = -1;
+        // The window props need the scores of every frame.
+        params->lookahead = (window) ? std::max(lookahead, 1) : lookahead;
+        params->window = window;
+        // Frames requested out of order may be read a bit later than they are scored, the shards share the history.
+        params->historySize = 2 * (static_cast<size_t>(window) + params->lookahead + queueDepth) * shards;
+        params->pool.resize(params->model.size() + params->featureN.size());
+
+        for (auto &&scorePool : params->pool)
+        {
+            for (auto &&p : percentile)
+                scorePool.quantile.emplace_back(VMAFQuantile{p, {}, {}, {}, 0});
+        }
+
+        // Every shard gets its share of the worker threads.
+        params->configuration.log_level = VMAF_LOG_LEVEL_INFO;
+        params->configuration.n_threads = (threads) ? std::max(threads / shards, 1) : 0;
+        params->configuration.n_subsample = subsample;
+        params->configuration.cpumask = cpumask;
+
+        // The frames the worker threads may still be extracting are streamed to the log later (the most threads a share can have).
+        params->logLag = params->configuration.n_threads + 1;
+
+        // Without `threads` the share is taken when a context is created, the instances created later shrink it.
+        params->threadWeight = (avs_defined(avs_array_elt(args, 8))) ? 0.0 : threadWeight;
+        params->threadsReserved = (avs_defined(avs_array_elt(args, 8))) ? threads : 0;
+        params->numShard = shards;
+        vmaf_budget_join(params->threadWeight, params->threadsReserved);
+
+        for (int i = 0; i < shards && !avs_defined(v); ++i)
+        {
+            VMAFShard *shard = params->shards.emplace_back(std::make_unique<VMAFShard>()).get();
+            shard->begin = start + static_cast<int>(static_cast<int64_t>(end - start + 1) * i / shards);
+            shard->end = start + static_cast<int>(static_cast<int64_t>(end - start + 1) * (i + 1) / shards) - 1;
+            // The samples have no neighbours for motion, the last one is the last multiple of step.
+            shard->first = (sparse) ? shard->begin : std::max(shard->begin - 1, 0);
+            shard->last = (sparse) ? shard->begin + (shard->end - shard->begin) / step * step : std::min(shard->end + 1, fi->vi.num_frames - 1);
+            shard->next = shard->first;
+            shard->submitted = shard->first;
+            shard->decided = shard->first - 1;
+
+            shard->written = shard->begin;
+            shard->lastSubmitted = -1;
+        }
+    }
+
+    if (!avs_defined(v) && avs_defined(avs_array_elt(args, 15)))
+    {
+        // Everything the per-frame scores depend on besides the frames.
+        std::string settings = "1 "s + vmaf_version() + " " + std::to_string(fi->vi.width) + "x" + std::to_string(fi->vi.height) + " " +
+            std::to_string(avs_bits_per_component(&fi->vi)) + " " + std::to_string(params->pixelFormat) + " " + std::to_string(params->chroma);
+
+        for (auto &&name : params->modelN)
+            settings += " "s + name;
+        for (auto &&name : params->featureN)
+            settings += " "s + name;
+        for (auto &&[name, value] : params->cambiOpt)
+            settings += " " + name + "=" + value;
+        if (params->refInput.rgb || params->distInput.rgb)
+            settings += " matrix=" + matrix;
+        if (params->distInput.resize)
+            settings += " scale=" + scale + " " + std::to_string(params->resize[0].srcWidth) + "x" + std::to_string(params->resize[0].srcHeight);
+
+        params->cacheSettings = vmaf_hash(0, reinterpret_cast<const uint8_t *>(settings.data()), settings.size());
+
+        char fileName[32];
+        snprintf(fileName, sizeof(fileName), "%016llx.vmafcache", static_cast<unsigned long long>(params->cacheSettings));
+
+        // The cache file is opened (and read) by vmaf_start.
+        params->cacheFile = std::filesystem::path(avs_as_string(avs_array_elt(args, 15))) / fileName;
+
+        std::error_code ec;
+
+        if (std::filesystem::exists(params->cacheFile.parent_path(), ec) && !std::filesystem::is_directory(params->cacheFile.parent_path(), ec))
+            v = avs_new_value_error("VMAF: cache_path must be a directory.");
+    }
+
+    if (!avs_defined(v) && params->logPath.empty())
+        v = avs_new_value_error("VMAF: log_path cannot be empty.");
+
+    return v;
+}
+
+AVS_Value AVSC_CC Create_VMAF(AVS_ScriptEnvironment *env, AVS_Value args, void *param)
+{
+    AVS_FilterInfo *fi;
+
+    AVS_Clip *clip = avs_new_c_filter(env, &fi, avs_array_elt(args, 0), 1);
+
+    VMAFLadder *params = new VMAFLadder();
+
+    const int numRung = avs_array_size(avs_array_elt(args, 1));
+
+    AVS_Value v = avs_void;
+
+    if (avs_array_size(avs_array_elt(args, 2)) != numRung)
+        v = avs_new_value_error("VMAF: the number of log_path must be the same as the number of distorted clips.");
+
+    // timing - 1: summary in the log, 2: frame properties, 3: both (validated by the rungs).
+    const int timing = (avs_is_int(avs_array_elt(args, 22))) ? avs_as_int(avs_array_elt(args, 22)) : 0;
+    const int threads = (avs_is_int(avs_array_elt(args, 8))) ? avs_as_int(avs_array_elt(args, 8)) : std::thread::hardware_concurrency();
+
+    if ((timing > 0 && timing <= 3) || avs_defined(avs_array_elt(args, 23)))
+        params->timing = std::make_unique<VMAFTiming>();
+    params->timingProps = timing & 2;
+
+    if (!avs_defined(v) && avs_defined(avs_array_elt(args, 23)))
+    {
+        if (FILE *file = fopen(avs_as_string(avs_array_elt(args, 23)), "w"))
+            params->timing->trace = std::make_unique<VMAFTrace>(file, "VMAF (libvmaf threads: " + ((avs_defined(avs_array_elt(args, 8))) ? std::to_string(threads) : "shared"s) + ")");
         else
-            params->pixelFormat = VMAF_PIX_FMT_YUV444P;
+            v = avs_new_value_error("VMAF: cannot open trace_path.");
+    }
 
-        v = avs_new_value_clip(clip);
+    for (int i = 0; i < numRung && !avs_defined(v); ++i)
+    {
+        VMAF *rung = params->rungs.emplace_back(std::make_unique<VMAF>()).get();
+        rung->distorted = avs_take_clip(avs_array_elt(avs_array_elt(args, 1), i), env);
+        rung->logPath = avs_as_string(avs_array_elt(avs_array_elt(args, 2), i));
+        rung->timing = params->timing.get();
+
+        // Frame properties of the rungs are told apart by their index.
+        if (numRung > 1)
+            rung->propSuffix = "_" + std::to_string(i);
+
+        v = vmaf_init_rung(env, fi, args, rung);
     }
 
+    if (!avs_defined(v))
+        v = avs_new_value_clip(clip);
+
     fi->user_data = reinterpret_cast<void *>(params);
     fi->get_frame = vmaf_get_frame;
     fi->set_cache_hints = vmaf_set_cache_hints;
@@ -26,14 +26,27 @@
 */
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstdio>
 #include <cstring>
 #include <filesystem>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <regex>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VMAF_SSE2
+#endif
+
 #include "avisynth_c.h"
 
 extern "C" {
@@ -46,5 +59,526 @@ static constexpr const char *modelName[] = {"vmaf", "vmaf_neg", "vmaf_b", "vmaf_
 static constexpr const char *modelVersion[] = {"vmaf_v0.6.1", "vmaf_v0.6.1neg", "vmaf_b_v0.6.3", "vmaf_4k_v0.6.1"};
 static constexpr const char *featureName[] = {"psnr", "psnr_hvs", "float_ssim", "float_ms_ssim", "ciede", "cambi"};
 
+static inline void vmaf_copy_plane(AVS_ScriptEnvironment *env, VmafPicture *pic, int plane, AVS_VideoFrame *frame, int avsPlane)
+{
+    uint8_t *dstp = reinterpret_cast<uint8_t *>(pic->data[plane]);
+    const uint8_t *srcp = avs_get_read_ptr_p(frame, avsPlane);
+    const int pitch = avs_get_pitch_p(frame, avsPlane);
+    const int rowsize = avs_get_row_size_p(frame, avsPlane);
+    const int height = avs_get_height_p(frame, avsPlane);
+
+    // Same layout - the plane is one contiguous block including the row padding.
+    if (pitch == pic->stride[plane])
+        memcpy(dstp, srcp, static_cast<size_t>(pitch) * (height - 1) + rowsize);
+    else
+        avs_bit_blt(env, dstp, pic->stride[plane], srcp, pitch, rowsize, height);
+}
+
+// RGB -> YUV: out[i] = m[i][0] * r + m[i][1] * g + m[i][2] * b + offset[i] (the clip's samples, not normalized),
+// rounded to nearest and clamped to 0..peak.
+struct VMAFMatrix
+{
+    float m[3][3];
+    float offset[3];
+    int peak;
+};
+
+// Row kernels of the conversion from the clip's samples to the libvmaf picture's, picked at runtime (convert*.cpp).
+struct VMAFConvert
+{
+    // High bit depth integer: rounded right shift, clamped to peak.
+    void (*shift)(const uint16_t *srcp, uint16_t *dstp, int width, int shift, int peak);
+    // Float: srcp * scale + offset rounded to nearest, clamped to 0..peak.
+    void (*scale)(const float *srcp, uint16_t *dstp, int width, float scale, float offset, int peak);
+    // 2:1 chroma downsampling of two rows (the same row when only horizontal), width is the destination width.
+    void (*downsample8)(const uint8_t *row0, const uint8_t *row1, uint8_t *dstp, int width, int subX);
+    void (*downsample16)(const uint16_t *row0, const uint16_t *row1, uint16_t *dstp, int width, int subX);
+    // Planar RGB rows (r, g, b) of the clip's bit depth to Y, U, V rows of the picture's (8 or 10), no U, V when dstp[1] is null.
+    void (*rgb)(const uint8_t *const *srcp, uint8_t *const *dstp, int width, int bits, int bpc, const VMAFMatrix *matrix);
+    // Resize with 14-bit fixed point coefficients, rounded and clamped to 0..peak after each pass.
+    // Horizontal: dstp[x] = sum(coef[k * width + x] * srcp[left[x] + k]), srcp 8- or 16-bit by bpc, readable 3 bytes past the row.
+    void (*resizeH)(const uint8_t *srcp, uint16_t *dstp, int width, int taps, const int *left, const int32_t *coef, int bpc, int peak);
+    // Vertical: dstp[x] = sum(coef[k] * rows[k][x]), dstp 8- or 16-bit by bpc.
+    void (*resizeV)(const uint16_t *const *rows, uint8_t *dstp, int width, int taps, const int32_t *coef, int bpc, int peak);
+};
+
+void vmaf_shift_row_c(const uint16_t *srcp, uint16_t *dstp, int width, int shift, int peak);
+void vmaf_shift_row_avx2(const uint16_t *srcp, uint16_t *dstp, int width, int shift, int peak);
+void vmaf_shift_row_avx512(const uint16_t *srcp, uint16_t *dstp, int width, int shift, int peak);
+void vmaf_scale_row_c(const float *srcp, uint16_t *dstp, int width, float scale, float offset, int peak);
+void vmaf_scale_row_avx2(const float *srcp, uint16_t *dstp, int width, float scale, float offset, int peak);
+void vmaf_scale_row_avx512(const float *srcp, uint16_t *dstp, int width, float scale, float offset, int peak);
+void vmaf_downsample8_c(const uint8_t *row0, const uint8_t *row1, uint8_t *dstp, int width, int subX);
+void vmaf_downsample8_avx2(const uint8_t *row0, const uint8_t *row1, uint8_t *dstp, int width, int subX);
+void vmaf_downsample8_avx512(const uint8_t *row0, const uint8_t *row1, uint8_t *dstp, int width, int subX);
+void vmaf_downsample16_c(const uint16_t *row0, const uint16_t *row1, uint16_t *dstp, int width, int subX);
+void vmaf_downsample16_avx2(const uint16_t *row0, const uint16_t *row1, uint16_t *dstp, int width, int subX);
+void vmaf_downsample16_avx512(const uint16_t *row0, const uint16_t *row1, uint16_t *dstp, int width, int subX);
+// The samples [x, width) for the SIMD versions.
+void vmaf_downsample8_tail(const uint8_t *row0, const uint8_t *row1, uint8_t *dstp, int x, int width, int subX);
+void vmaf_downsample16_tail(const uint16_t *row0, const uint16_t *row1, uint16_t *dstp, int x, int width, int subX);
+void vmaf_rgb_row_c(const uint8_t *const *srcp, uint8_t *const *dstp, int width, int bits, int bpc, const VMAFMatrix *matrix);
+void vmaf_rgb_row_avx2(const uint8_t *const *srcp, uint8_t *const *dstp, int width, int bits, int bpc, const VMAFMatrix *matrix);
+void vmaf_rgb_row_avx512(const uint8_t *const *srcp, uint8_t *const *dstp, int width, int bits, int bpc, const VMAFMatrix *matrix);
+void vmaf_rgb_row_tail(const uint8_t *const *srcp, uint8_t *const *dstp, int x, int width, int bits, int bpc, const VMAFMatrix *matrix);
+void vmaf_resize_h_c(const uint8_t *srcp, uint16_t *dstp, int width, int taps, const int *left, const int32_t *coef, int bpc, int peak);
+void vmaf_resize_h_avx2(const uint8_t *srcp, uint16_t *dstp, int width, int taps, const int *left, const int32_t *coef, int bpc, int peak);
+void vmaf_resize_h_avx512(const uint8_t *srcp, uint16_t *dstp, int width, int taps, const int *left, const int32_t *coef, int bpc, int peak);
+void vmaf_resize_v_c(const uint16_t *const *rows, uint8_t *dstp, int width, int taps, const int32_t *coef, int bpc, int peak);
+void vmaf_resize_v_avx2(const uint16_t *const *rows, uint8_t *dstp, int width, int taps, const int32_t *coef, int bpc, int peak);
+void vmaf_resize_v_avx512(const uint16_t *const *rows, uint8_t *dstp, int width, int taps, const int32_t *coef, int bpc, int peak);
+void vmaf_resize_h_tail(const uint8_t *srcp, uint16_t *dstp, int x, int width, int taps, const int *left, const int32_t *coef, int bpc, int peak);
+void vmaf_resize_v_tail(const uint16_t *const *rows, uint8_t *dstp, int x, int width, int taps, const int32_t *coef, int bpc, int peak);
+
+const VMAFConvert *vmaf_get_convert(int cpuFlags);
+
+// rec601, rec709, rec2020 (limited range), pc.601, pc.709, pc.2020 (full range), false for other names.
+bool vmaf_get_matrix(const std::string &name, int bits, int bpc, VMAFMatrix *matrix);
+
+// Resize of one plane. Coefficients: horizontal [k * dstWidth + x], vertical [y * tapsV + k].
+struct VMAFResizePlane
+{
+    int srcWidth;
+    int srcHeight;
+    int dstWidth;
+    int dstHeight;
+    int tapsH;
+    int tapsV;
+    std::vector<int> leftH;
+    std::vector<int> leftV;
+    std::vector<int32_t> coefH;
+    std::vector<int32_t> coefV;
+};
+
+// bicubic (b = c = 1/3) or lanczos (3 taps), false for other names.
+bool vmaf_init_resize(VMAFResizePlane *resize, const std::string &kernel, int srcWidth, int srcHeight, int dstWidth, int dstHeight);
+// The Y, U, V resizes of the clip vi to width x height pictures of pixelFormat, false for other kernel names.
+bool vmaf_init_resize(std::vector<VMAFResizePlane> *resize, const std::string &kernel, const AVS_VideoInfo *vi, int width, int height, VmafPixelFormat pixelFormat);
+// Samples of bpc bits (8: uint8_t, 9..16: uint16_t), srcp rows readable 3 bytes past srcWidth samples.
+void vmaf_resize_plane(const VMAFConvert *convert, const VMAFResizePlane &resize, const uint8_t *srcp, ptrdiff_t srcStride, uint8_t *dstp, ptrdiff_t dstStride, int bpc);
+
+// How the frames of a clip are written into the libvmaf pictures.
+struct VMAFInput
+{
+    int bits; // 8..16, 32 - float
+    int subX; // 1 - the chroma planes are downsampled 2:1 horizontally
+    int subY; // 1 - vertically
+    bool rgb; // planar RGB, converted to YUV444 with matrix
+    VMAFMatrix matrix;
+    const VMAFResizePlane *resize; // the Y, U, V resizes when the clip has other dimensions than the pictures
+};
+
+// libvmaf models are trained up to 10-bit, 12..16-bit and float clips are converted to 10-bit.
+static inline int vmaf_picture_bits(const AVS_VideoInfo *vi)
+{
+    return std::min(avs_bits_per_component(vi), 10);
+}
+
+// YUV 420/422/444 or RGB planar with minimum three planes.
+static inline bool vmaf_is_supported(const AVS_VideoInfo *vi)
+{
+    return avs_is_planar(vi) && avs_num_components(vi) >= 3 && (avs_is_rgb(vi) || avs_is_420(vi) || avs_is_422(vi) || avs_is_444(vi));
+}
+
+// The libvmaf pixel format with the lower chroma resolution of the two clips (RGB counts as 444).
+static inline VmafPixelFormat vmaf_picture_format(const AVS_VideoInfo *vi, const AVS_VideoInfo *vi1)
+{
+    if (avs_is_420(vi) || avs_is_420(vi1))
+        return VMAF_PIX_FMT_YUV420P;
+    if (avs_is_422(vi) || avs_is_422(vi1))
+        return VMAF_PIX_FMT_YUV422P;
+
+    return VMAF_PIX_FMT_YUV444P;
+}
+
+// matrix is only used by RGB clips and must be valid for them.
+static inline VMAFInput vmaf_input(const AVS_VideoInfo *vi, VmafPixelFormat pixelFormat, const std::string &matrix)
+{
+    VMAFInput input{};
+    input.bits = avs_bits_per_component(vi);
+    input.rgb = avs_is_rgb(vi);
+    input.subX = (pixelFormat != VMAF_PIX_FMT_YUV444P && (input.rgb || avs_is_444(vi))) ? 1 : 0;
+    input.subY = (pixelFormat == VMAF_PIX_FMT_YUV420P && !avs_is_420(vi)) ? 1 : 0;
+
+    if (input.rgb)
+        vmaf_get_matrix(matrix, input.bits, vmaf_picture_bits(vi), &input.matrix);
+
+    return input;
+}
+
+// Writes the luma (and chroma) planes of the frame into the libvmaf picture.
+void vmaf_write_picture(AVS_ScriptEnvironment *env, const VMAFConvert *convert, VmafPicture *pic, AVS_VideoFrame *frame, const VMAFInput &input, bool chroma);
+
+static inline bool vmaf_rows_equal(const uint8_t *a, const uint8_t *b, int size)
+{
+    int x = 0;
+
+#ifdef VMAF_SSE2
+    // 64 bytes per step, the compare results are only inspected once per step.
+    for (; x + 64 <= size; x += 64)
+    {
+        __m128i eq = _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + x)), _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + x))),
+            _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + x + 16)), _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + x + 16))));
+        eq = _mm_and_si128(eq, _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + x + 32)), _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + x + 32))));
+        eq = _mm_and_si128(eq, _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + x + 48)), _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + x + 48))));
+
+        if (_mm_movemask_epi8(eq) != 0xFFFF)
+            return false;
+    }
+
+    for (; x + 16 <= size; x += 16)
+    {
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + x)), _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + x)))) != 0xFFFF)
+            return false;
+    }
+#endif
+
+    return !memcmp(a + x, b + x, size - x);
+}
+
+// Compares the visible part of a plane of two frames of the same format.
+static inline bool vmaf_planes_equal(AVS_VideoFrame *a, AVS_VideoFrame *b, int avsPlane)
+{
+    if (a == b)
+        return true;
+
+    const uint8_t *srcp1 = avs_get_read_ptr_p(a, avsPlane);
+    const uint8_t *srcp2 = avs_get_read_ptr_p(b, avsPlane);
+    const int pitch1 = avs_get_pitch_p(a, avsPlane);
+    const int pitch2 = avs_get_pitch_p(b, avsPlane);
+    const int rowsize = avs_get_row_size_p(a, avsPlane);
+    const int height = avs_get_height_p(a, avsPlane);
+
+    if (srcp1 == srcp2 && pitch1 == pitch2)
+        return true;
+
+    for (int y = 0; y < height; ++y)
+    {
+        if (!vmaf_rows_equal(srcp1 + static_cast<ptrdiff_t>(y) * pitch1, srcp2 + static_cast<ptrdiff_t>(y) * pitch2, rowsize))
+            return false;
+    }
+
+    return true;
+}
+
+// Pictures allocated for a single frame (not taken from a preallocated pool) by all the instances.
+// vmaf_bench reports the ones allocated after the first frame.
+inline std::atomic<uint64_t> vmafPictureAllocations;
+
+// The libvmaf worker threads of all the VMAF/VMAF2 instances of the process share hardware_concurrency().
+// Instances with `threads` reserve them, the others split what is left in proportion to `thread_weight`.
+struct VMAFThreadBudget
+{
+    std::mutex mutex;
+    double weight;
+    int reserved;
+};
+
+inline VMAFThreadBudget vmafThreadBudget;
+
+// weight > 0 - takes a share, otherwise reserves `threads`.
+inline void vmaf_budget_join(double weight, int threads)
+{
+    std::lock_guard<std::mutex> lock(vmafThreadBudget.mutex);
+
+    vmafThreadBudget.weight += weight;
+    vmafThreadBudget.reserved += threads;
+}
+
+inline void vmaf_budget_leave(double weight, int threads)
+{
+    std::lock_guard<std::mutex> lock(vmafThreadBudget.mutex);
+
+    vmafThreadBudget.weight = (vmafThreadBudget.weight - weight > 1e-9) ? vmafThreadBudget.weight - weight : 0.0;
+    vmafThreadBudget.reserved -= threads;
+}
+
+// The threads of an instance with `weight` for a context created now (at least 1).
+inline int vmaf_budget_share(double weight)
+{
+    std::lock_guard<std::mutex> lock(vmafThreadBudget.mutex);
+
+    const int budget = std::max(static_cast<int>(std::thread::hardware_concurrency()) - vmafThreadBudget.reserved, 1);
+
+    return std::max(static_cast<int>(budget * weight / std::max(vmafThreadBudget.weight, weight)), 1);
+}
+
+// `timing` - the time spent in each stage of the frame requests and of the submitter threads.
+enum VMAFStage
+{
+    VMAF_STAGE_FETCH, // avs_get_frame of the clips (the upstream filters)
+    VMAF_STAGE_INIT,  // creating a libvmaf context (vmaf_init and the feature extractors)
+    VMAF_STAGE_ALLOC, // getting the pictures (the preallocated ones or vmaf_picture_alloc)
+    VMAF_STAGE_COPY,  // writing the frames into the pictures (vmaf_write_picture)
+    VMAF_STAGE_READ,  // vmaf_read_pictures - the feature extractors, or handing the pictures to the libvmaf threads
+    VMAF_STAGE_FLUSH, // flushing a context (the libvmaf threads finishing their pictures)
+    VMAF_STAGE_WAIT,  // waiting for the submitter thread (queue_depth) or the scores (lookahead)
+    VMAF_STAGE_TOTAL, // the whole frame request
+    VMAF_STAGE_COUNT
+};
+
+static constexpr const char *stageName[] = {"Fetch", "Init", "Alloc", "Copy", "Read", "Flush", "Wait", "Total"};
+
+// `trace_path` - one span per stage in the trace event format (chrome://tracing, Perfetto).
+// Every thread appends to its own buffer, the buffers are only read when the trace is written (no thread is left then).
+struct VMAFTraceEvent
+{
+    int stage;
+    int n;
+    // ns from the start of the trace
+    int64_t start;
+    int64_t duration;
+};
+
+struct VMAFTraceBuffer
+{
+    std::vector<VMAFTraceEvent> events;
+    int tid;
+    VMAFTraceBuffer *next;
+};
+
+// Tells the traces apart in the buffer lookup of the threads (the addresses may be reused).
+inline std::atomic<uint64_t> vmafTraceId;
+
+class VMAFTrace
+{
+public:
+    VMAFTrace(FILE *file, std::string name)
+        : file_(file), name_(std::move(name)), id_(++vmafTraceId), start_(std::chrono::steady_clock::now()), buffers_(nullptr), numBuffer_(0)
+    {
+    }
+
+    ~VMAFTrace()
+    {
+        for (VMAFTraceBuffer *b = buffers_.load(); b;)
+        {
+            VMAFTraceBuffer *next = b->next;
+            delete b;
+            b = next;
+        }
+
+        fclose(file_);
+    }
+
+    void add(int stage, int n, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+    {
+        buffer()->events.push_back({stage, n, std::chrono::duration_cast<std::chrono::nanoseconds>(start - start_).count(),
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()});
+    }
+
+    // Returns false if the file cannot be written.
+    // otherData - the members of the `otherData` object (totals of the whole run), written if not empty.
+    bool write(const std::string &otherData = "")
+    {
+        std::string record = "{\"displayTimeUnit\": \"ms\", ";
+
+        if (!otherData.empty())
+            record += "\"otherData\": {" + otherData + "}, ";
+
+        record += "\"traceEvents\": [\n{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"" + name_ + "\"}}";
+
+        for (const VMAFTraceBuffer *b = buffers_.load(); b; b = b->next)
+        {
+            record += ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " + std::to_string(b->tid) +
+                ", \"args\": {\"name\": \"thread " + std::to_string(b->tid) + "\"}}";
+
+            for (auto &&e : b->events)
+            {
+                char event[192];
+                int size = snprintf(event, sizeof(event), ",\n{\"name\": \"%s\", \"cat\": \"vmaf\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+                    stageName[e.stage], b->tid, e.start / 1000.0, e.duration / 1000.0);
+
+                if (e.n >= 0)
+                    size += snprintf(event + size, sizeof(event) - size, ", \"args\": {\"frame\": %d}", e.n);
+
+                record.append(event, size);
+                record += "}";
+
+                // The events of long clips are written in parts.
+                if (record.size() > (1 << 20))
+                {
+                    if (fputs(record.c_str(), file_) < 0)
+                        return false;
+
+                    record.clear();
+                }
+            }
+        }
+
+        record += "\n]}\n";
+
+        return fputs(record.c_str(), file_) >= 0 && !fflush(file_);
+    }
+
+private:
+    // The buffer of the calling thread, added to the list the first time the thread traces.
+    VMAFTraceBuffer *buffer()
+    {
+        // The buffers of every trace the thread has used (nested filters), by trace id.
+        // Never evicted, a thread coming back to a trace must get the same buffer (and tid).
+        thread_local std::unordered_map<uint64_t, VMAFTraceBuffer *> entries;
+
+        const auto it = entries.find(id_);
+        if (it != entries.end())
+            return it->second;
+
+        VMAFTraceBuffer *b = new VMAFTraceBuffer{{}, ++numBuffer_, buffers_.load()};
+        b->events.reserve(4096);
+
+        while (!buffers_.compare_exchange_weak(b->next, b))
+            ;
+
+        entries.emplace(id_, b);
+
+        return b;
+    }
+
+    FILE *file_;
+    std::string name_;
+    uint64_t id_;
+    std::chrono::steady_clock::time_point start_;
+    std::atomic<VMAFTraceBuffer *> buffers_;
+    std::atomic<int> numBuffer_;
+};
+
+// Histograms of the stage durations (microseconds), updated from any thread without locking.
+// Log-linear buckets: exact below 8 us, then 8 per power of two (the percentiles are within 7%).
+struct VMAFTiming
+{
+    static constexpr int numBucket = 8 * 40;
+
+    struct Stage
+    {
+        std::atomic<uint64_t> bucket[numBucket];
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> sum;
+        std::atomic<uint64_t> max;
+    };
+
+    Stage stage[VMAF_STAGE_COUNT];
+    // Null without trace_path.
+    std::unique_ptr<VMAFTrace> trace;
+
+    void add(int s, uint64_t us)
+    {
+        int e = 3;
+        while (e < 39 && (us >> (e + 1)))
+            ++e;
+
+        const int b = (us < 8) ? static_cast<int>(us) : (e - 2) * 8 + static_cast<int>((us >> (e - 3)) & 7);
+
+        stage[s].bucket[b].fetch_add(1, std::memory_order_relaxed);
+        stage[s].count.fetch_add(1, std::memory_order_relaxed);
+        stage[s].sum.fetch_add(us, std::memory_order_relaxed);
+
+        for (uint64_t max = stage[s].max.load(std::memory_order_relaxed); us > max && !stage[s].max.compare_exchange_weak(max, us, std::memory_order_relaxed);)
+            ;
+    }
+
+    // The middle of the bucket holding the p-th (0..1) duration (at most the maximum).
+    double percentile(int s, double p) const
+    {
+        const uint64_t count = stage[s].count.load(std::memory_order_relaxed);
+        const uint64_t rank = std::max<uint64_t>(static_cast<uint64_t>(p * count + 0.5), 1);
+        uint64_t seen = 0;
+
+        for (int b = 0; b < numBucket; ++b)
+        {
+            seen += stage[s].bucket[b].load(std::memory_order_relaxed);
+
+            if (seen >= rank)
+            {
+                if (b < 8)
+                    return b;
+
+                const int e = b / 8 + 2;
+                const double middle = static_cast<double>(static_cast<uint64_t>(17 + 2 * (b % 8)) << (e - 3)) / 2.0;
+
+                return std::min(middle, static_cast<double>(stage[s].max.load(std::memory_order_relaxed)));
+            }
+        }
+
+        return static_cast<double>(stage[s].max.load(std::memory_order_relaxed));
+    }
+};
+
+// The stages of the frame request running on this thread (ms, the `_VMAFTime*` frame properties), null outside of one.
+inline thread_local double *vmafFrameTime;
+
+// Times a stage when timing is on. Otherwise it does nothing, the clock isn't read.
+class VMAFStageTimer
+{
+public:
+    // n - the frame of the span in the trace (-1 if none).
+    VMAFStageTimer(VMAFTiming *timing, VMAFStage stage, int n = -1) : timing_(timing), stage_(stage), n_(n)
+    {
+        if (timing_)
+            start_ = std::chrono::steady_clock::now();
+    }
+
+    ~VMAFStageTimer()
+    {
+        stop();
+    }
+
+    void stop()
+    {
+        if (!timing_)
+            return;
+
+        const auto end = std::chrono::steady_clock::now();
+        const auto us = std::chrono::duration_cast<std::chrono::microseconds>(end - start_).count();
+
+        timing_->add(stage_, us);
+
+        if (timing_->trace)
+            timing_->trace->add(stage_, n_, start_, end);
+
+        if (vmafFrameTime)
+            vmafFrameTime[stage_] += us / 1000.0;
+
+        timing_ = nullptr;
+    }
+
+private:
+    VMAFTiming *timing_;
+    VMAFStage stage_;
+    int n_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Starts the stages of a frame request on this thread, the previous ones are restored at the end (nested filters).
+class VMAFFrameTimer
+{
+public:
+    VMAFFrameTimer(VMAFTiming *timing, int n) : total_(timing, VMAF_STAGE_TOTAL, n), previous_(vmafFrameTime), time_()
+    {
+        if (timing)
+            vmafFrameTime = time_;
+    }
+
+    ~VMAFFrameTimer()
+    {
+        total_.stop();
+        vmafFrameTime = previous_;
+    }
+
+    // `_VMAFTime<stage>` frame properties in ms, the total is up to this call.
+    void set_props(AVS_ScriptEnvironment *env, AVS_VideoFrame *frame)
+    {
+        total_.stop();
+
+        AVS_Map *props = avs_get_frame_props_rw(env, frame);
+
+        for (int i = 0; i < VMAF_STAGE_COUNT; ++i)
+            avs_prop_set_float(env, props, ("_VMAFTime"s + stageName[i]).c_str(), time_[i], 0);
+    }
+
+private:
+    VMAFStageTimer total_;
+    double *previous_;
+    double time_[VMAF_STAGE_COUNT];
+};
+
 AVS_Value AVSC_CC Create_VMAF(AVS_ScriptEnvironment *env, AVS_Value args, void *param);
 AVS_Value AVSC_CC Create_VMAF2(AVS_ScriptEnvironment *env, AVS_Value args, void *param);
@@ -1,145 +1,245 @@
 #include "VMAF.h"
 
+// The frames a kept context scores before it is replaced (its memory grows with every frame).
+static constexpr unsigned contextFrames = 1024;
+
+struct VMAF2Context
+{
+    VmafContext* vmaf;
+    unsigned index;
+};
+
 struct VMAF2
 {
     AVS_Clip* distorted;
     VmafPixelFormat pixelFormat;
     bool chroma;
+    const VMAFConvert* convert;
+    VMAFInput refInput;
+    VMAFInput distInput;
+    std::vector<VMAFResizePlane> resize;
     int numFeature;
     std::vector<int> feature;
     std::vector<const char*> featureN;
-    std::vector<std::string> match;
-    int f;
+    std::vector<double> identicalScore;
+    // The frames compared for the identical path and the ones that took it.
+    std::atomic<int64_t> comparedFrames;
+    std::atomic<int64_t> identicalFrames;
+    std::vector<std::pair<std::string, std::string>> cambiOpt;
+    int threads;
+    // threadWeight - with `thread_weight` every frame takes the share of the thread budget.
+    // threadsReserved - `threads`. Both are 0 until the filter joins the budget.
+    double threadWeight;
+    int threadsReserved;
+    int cpumask;
+    std::vector<VMAF2Context> contexts;
+    std::mutex contextMutex;
+    // Null without timing and trace_path.
+    std::unique_ptr<VMAFTiming> timing;
+    bool timingProps;
 };
 
-AVS_VideoFrame* AVSC_CC vmaf2_get_frame(AVS_FilterInfo* fi, int n)
+// The messages outlive the call, they end up in fi->error.
+static constexpr const char* featureError[] = { "VMAF2: failed to load feature extractor: psnr.", "VMAF2: failed to load feature extractor: psnr_hvs.",
+    "VMAF2: failed to load feature extractor: float_ssim.", "VMAF2: failed to load feature extractor: float_ms_ssim.",
+    "VMAF2: failed to load feature extractor: ciede.", "VMAF2: failed to load feature extractor: cambi." };
+
+static const char* vmaf2_init_context(VMAF2* d, VmafContext** vmaf, int threads)
 {
     const char* ErrorText = 0;
-    VMAF2* d = reinterpret_cast<VMAF2*>(fi->user_data);
+    VMAFStageTimer timer(d->timing.get(), VMAF_STAGE_INIT);
 
     VmafConfiguration configuration{};
     configuration.log_level = VMAF_LOG_LEVEL_NONE;
-    configuration.n_threads = 0;
+    configuration.n_threads = threads;
     configuration.n_subsample = 1;
-    configuration.cpumask = 0;
+    configuration.cpumask = d->cpumask;
 
-    VmafContext* vmaf;
+    if (vmaf_init(vmaf, configuration))
+        return "VMAF2: failed to initialize VMAF2 context.";
 
-    if (vmaf_init(&vmaf, configuration))
-        ErrorText = "VMAF2: failed to initialize VMAF2 context.";
-
-    if (!ErrorText)
+    for (int i = 0; i < d->numFeature; ++i)
     {
-        for (int i = 0; i < d->numFeature; ++i)
+        if (!ErrorText && d->feature[i] == 5)
         {
-            if (!ErrorText && d->feature[i] == 5)
+            if (!d->cambiOpt.empty())
             {
-                if (d->f)
-                {
-                    VmafFeatureDictionary* featureDictionary{};
-
-                    for (int i = 1; i < d->match.size(); i += 2)
-                    {
-                        if (d->match[i].length() == 0)
-                            break;
+                VmafFeatureDictionary* featureDictionary{};
 
-                        if (vmaf_feature_dictionary_set(&featureDictionary, d->match[i].c_str(), d->match[i + 1].c_str()))
-                        {
-                            static const std::string m = "VMAF2: failed to set cambi option "s + d->match[i] + "."s;
-                            ErrorText = (m).c_str();
-                            break;
-                        }
-                    }
-
-                    if (!ErrorText && vmaf_use_feature(vmaf, "cambi", featureDictionary))
+                for (auto&& [name, value] : d->cambiOpt)
+                {
+                    if (vmaf_feature_dictionary_set(&featureDictionary, name.c_str(), value.c_str()))
                     {
                         vmaf_feature_dictionary_free(&featureDictionary);
-                        ErrorText = "VMAF2: failed to load feature extractor: cambi.";
+                        ErrorText = "VMAF2: failed to set cambi option.";
+                        break;
                     }
-
-                    if (!ErrorText && d->feature[i] != 5 && vmaf_use_feature(vmaf, featureName[d->feature[i]], nullptr))
-                        ErrorText = ("VMAF2: failed to load feature extractor: "s + featureName[d->feature[i]]).c_str();
                 }
-                else
+
+                if (!ErrorText && vmaf_use_feature(*vmaf, "cambi", featureDictionary))
                 {
-                    if (vmaf_use_feature(vmaf, "cambi", nullptr))
-                        ErrorText = "VMAF2: failed to load feature extractor: cambi.";
+                    vmaf_feature_dictionary_free(&featureDictionary);
+                    ErrorText = "VMAF2: failed to load feature extractor: cambi.";
                 }
             }
-
-            if (!ErrorText && d->feature[i] != 5 && vmaf_use_feature(vmaf, featureName[d->feature[i]], nullptr))
-                ErrorText = ("VMAF2: failed to load feature extractor: "s + featureName[d->feature[i]]).c_str();
-
-            if (!ErrorText)
+            else
             {
-                if (!std::strcmp(featureName[d->feature[i]], "psnr") ||
-                    !std::strcmp(featureName[d->feature[i]], "psnr_hvs") ||
-                    !std::strcmp(featureName[d->feature[i]], "ciede"))
-                    d->chroma = true;
+                if (vmaf_use_feature(*vmaf, "cambi", nullptr))
+                    ErrorText = "VMAF2: failed to load feature extractor: cambi.";
             }
         }
 
+        if (!ErrorText && d->feature[i] != 5 && vmaf_use_feature(*vmaf, featureName[d->feature[i]], nullptr))
+            ErrorText = featureError[d->feature[i]];
     }
 
+    if (ErrorText)
+    {
+        vmaf_close(*vmaf);
+        *vmaf = nullptr;
+    }
+
+    return ErrorText;
+}
+
+AVS_VideoFrame* AVSC_CC vmaf2_get_frame(AVS_FilterInfo* fi, int n)
+{
+    const char* ErrorText = 0;
+    VMAF2* d = reinterpret_cast<VMAF2*>(fi->user_data);
+    VMAFFrameTimer frameTimer(d->timing.get(), n);
+    VMAFStageTimer fetchTimer(d->timing.get(), VMAF_STAGE_FETCH, n);
+
     AVS_VideoFrame* reference = avs_get_frame(fi->child, n);
     if (!reference)
-    {
-        vmaf_close(vmaf);
         return nullptr;
-    }
 
     AVS_VideoFrame* distorted = avs_get_frame(d->distorted, n);
     if (!distorted)
     {
-        vmaf_close(vmaf);
+        avs_release_video_frame(reference);
         return nullptr;
     }
 
+    fetchTimer.stop();
+
+    const int pl[3] = { AVS_PLANAR_Y, AVS_PLANAR_U, AVS_PLANAR_V };
+    const int rgb[3] = { AVS_PLANAR_R, AVS_PLANAR_G, AVS_PLANAR_B };
+    const int planecount = std::min(avs_num_components(&fi->vi), 3);
+
+    // The scores of bit-identical frames are known, they don't need libvmaf.
+    // _VMAFIdentical records which frames took this path, the totals go to the trace.
+    if (!d->identicalScore.empty())
+    {
+        bool identical = true;
+
+        for (int plane = 0; plane < planecount && identical; ++plane)
+        {
+            // The luma of RGB depends on every plane.
+            if (plane && !d->chroma && !d->refInput.rgb)
+                break;
+
+            identical = vmaf_planes_equal(reference, distorted, (d->refInput.rgb) ? rgb[plane] : pl[plane]);
+        }
+
+        AVS_Map* props = avs_get_frame_props_rw(fi->env, reference);
+        avs_prop_set_int(fi->env, props, "_VMAFIdentical", identical, 0);
+
+        ++d->comparedFrames;
+
+        if (identical)
+        {
+            ++d->identicalFrames;
+
+            for (size_t i = 0; i < d->featureN.size(); ++i)
+                avs_prop_set_float(fi->env, props, d->featureN[i], d->identicalScore[i], 0);
+
+            avs_release_video_frame(distorted);
+
+            if (d->timingProps)
+                frameTimer.set_props(fi->env, reference);
+
+            return reference;
+        }
+    }
+
+    // A flushed context cannot take more pictures, so only contexts without worker threads
+    // (where the scores are final once vmaf_read_pictures returns) are kept for the next frames.
+    // With worker threads every frame pays for vmaf_init, the flush and vmaf_close.
+    // With thread_weight a share of one thread gains nothing over the calling thread, the kept contexts are used then.
+    int threads = d->threads;
+
+    if (d->threadWeight > 0.0)
+    {
+        threads = vmaf_budget_share(d->threadWeight);
+
+        if (threads == 1)
+            threads = 0;
+    }
+
+    VMAF2Context context{};
+
+    if (!threads)
+    {
+        std::lock_guard<std::mutex> lock(d->contextMutex);
+
+        if (!d->contexts.empty())
+        {
+            context = d->contexts.back();
+            d->contexts.pop_back();
+        }
+    }
+
+    if (!context.vmaf)
+        ErrorText = vmaf2_init_context(d, &context.vmaf, threads);
+
     VmafPicture ref{};
     VmafPicture dist{};
 
-    if (vmaf_picture_alloc(&ref, d->pixelFormat, avs_bits_per_component(&fi->vi), fi->vi.width, fi->vi.height) ||
-        vmaf_picture_alloc(&dist, d->pixelFormat, avs_bits_per_component(&fi->vi), fi->vi.width, fi->vi.height))
-        ErrorText = "VMAF2: failed to allocate picture.";
+    if (!ErrorText)
+    {
+        VMAFStageTimer timer(d->timing.get(), VMAF_STAGE_ALLOC);
+        vmafPictureAllocations += 2;
 
-    const int pl[3] = { AVS_PLANAR_Y, AVS_PLANAR_U, AVS_PLANAR_V };
-    const int planecount = std::min(avs_num_components(&fi->vi), 3);
-    for (int plane = 0; plane < planecount; ++plane)
+        if (vmaf_picture_alloc(&ref, d->pixelFormat, vmaf_picture_bits(&fi->vi), fi->vi.width, fi->vi.height) ||
+            vmaf_picture_alloc(&dist, d->pixelFormat, vmaf_picture_bits(&fi->vi), fi->vi.width, fi->vi.height))
+            ErrorText = "VMAF2: failed to allocate picture.";
+    }
+
+    if (!ErrorText)
     {
-        if (plane && !d->chroma)
-            break;
-
-        avs_bit_blt(fi->env, reinterpret_cast<uint8_t*>(ref.data[plane]),
-            ref.stride[plane],
-            avs_get_read_ptr_p(reference, pl[plane]),
-            avs_get_pitch_p(reference, pl[plane]),
-            avs_get_row_size_p(reference, pl[plane]),
-            avs_get_height_p(reference, pl[plane]));
-
-        avs_bit_blt(fi->env, reinterpret_cast<uint8_t*>(dist.data[plane]),
-            dist.stride[plane],
-            avs_get_read_ptr_p(distorted, pl[plane]),
-            avs_get_pitch_p(distorted, pl[plane]),
-            avs_get_row_size_p(distorted, pl[plane]),
-            avs_get_height_p(distorted, pl[plane]));
+        VMAFStageTimer timer(d->timing.get(), VMAF_STAGE_COPY);
+
+        vmaf_write_picture(fi->env, d->convert, &ref, reference, d->refInput, d->chroma);
+        vmaf_write_picture(fi->env, d->convert, &dist, distorted, d->distInput, d->chroma);
     }
 
-    if (!ErrorText && vmaf_read_pictures(vmaf, &ref, &dist, n))
-        ErrorText = "VMAF2: failed to read pictures";
+    // Every context numbers its pictures itself, a frame requested twice is not a duplicate index.
+    if (!ErrorText)
+    {
+        VMAFStageTimer timer(d->timing.get(), VMAF_STAGE_READ);
 
-    if (vmaf_read_pictures(vmaf, nullptr, nullptr, 0))
-        ErrorText = "VMAF2: failed to flush context";
+        if (vmaf_read_pictures(context.vmaf, &ref, &dist, context.index))
+            ErrorText = "VMAF2: failed to read pictures";
+    }
+
+    if (!ErrorText && threads)
+    {
+        VMAFStageTimer timer(d->timing.get(), VMAF_STAGE_FLUSH);
+
+        if (vmaf_read_pictures(context.vmaf, nullptr, nullptr, 0))
+            ErrorText = "VMAF2: failed to flush context";
+    }
 
     vmaf_picture_unref(&ref);
     vmaf_picture_unref(&dist);
 
     if (!ErrorText && d->numFeature > 0)
     {
-        for (int i = 0; i < d->featureN.size(); ++i)
+        for (size_t i = 0; i < d->featureN.size(); ++i)
         {
             double score = -1;
 
-            if (vmaf_feature_score_at_index(vmaf, d->featureN[i], &score, n))
+            if (vmaf_feature_score_at_index(context.vmaf, d->featureN[i], &score, context.index))
             {
                 ErrorText = "VMAF2: failed to generate pooled VMAF2 feature score.";
                 break;
@@ -149,7 +249,19 @@ AVS_VideoFrame* AVSC_CC vmaf2_get_frame(AVS_FilterInfo* fi, int n)
         }
     }
 
-    vmaf_close(vmaf);
+    ++context.index;
+
+    if (context.vmaf)
+    {
+        // The feature collector of a context keeps the scores of all its frames, it is replaced after contextFrames.
+        if (ErrorText || threads || context.index >= contextFrames)
+            vmaf_close(context.vmaf);
+        else
+        {
+            std::lock_guard<std::mutex> lock(d->contextMutex);
+            d->contexts.emplace_back(context);
+        }
+    }
 
     if (ErrorText)
     {
@@ -164,6 +276,9 @@ AVS_VideoFrame* AVSC_CC vmaf2_get_frame(AVS_FilterInfo* fi, int n)
     {
         avs_release_video_frame(distorted);
 
+        if (d->timingProps)
+            frameTimer.set_props(fi->env, reference);
+
         return reference;
     }
 }
@@ -174,6 +289,17 @@ void AVSC_CC free_vmaf2(AVS_FilterInfo* fi)
 
     avs_release_clip(d->distorted);
 
+    for (auto&& c : d->contexts)
+        vmaf_close(c.vmaf);
+
+    vmaf_budget_leave(d->threadWeight, d->threadsReserved);
+
+    const std::string otherData = (d->identicalScore.empty()) ? "" :
+        "\"compared_frames\": " + std::to_string(d->comparedFrames) + ", \"identical_frames\": " + std::to_string(d->identicalFrames);
+
+    if (d->timing && d->timing->trace && !d->timing->trace->write(otherData))
+        std::cout << "VMAF2: failed to write trace_path.";
+
     delete d;
 }
 
@@ -191,25 +317,48 @@ AVS_Value AVSC_CC Create_VMAF2(AVS_ScriptEnvironment* env, AVS_Value args, void*
     VMAF2* params = new VMAF2();
 
     params->numFeature = (avs_defined(avs_array_elt(args, 2))) ? avs_array_size(avs_array_elt(args, 2)) : 0;
+    params->threads = (avs_is_int(avs_array_elt(args, 4))) ? avs_as_int(avs_array_elt(args, 4)) : 0;
+    params->cpumask = (avs_is_int(avs_array_elt(args, 5))) ? avs_as_int(avs_array_elt(args, 5)) : 0;
+    const double threadWeight = (avs_is_float(avs_array_elt(args, 10))) ? avs_as_float(avs_array_elt(args, 10)) : 0.0;
+    const std::string matrix = (avs_is_string(avs_array_elt(args, 6))) ? avs_as_string(avs_array_elt(args, 6)) : "rec709";
+    const std::string scale = (avs_is_string(avs_array_elt(args, 7))) ? avs_as_string(avs_array_elt(args, 7)) : "";
+
+    params->timingProps = (avs_is_bool(avs_array_elt(args, 8))) ? avs_as_bool(avs_array_elt(args, 8)) : false;
+
+    if (params->timingProps || avs_defined(avs_array_elt(args, 9)))
+        params->timing = std::make_unique<VMAFTiming>();
 
     AVS_Value v = avs_void;
 
-    if (avs_bits_per_component(&fi->vi) > 10)
-        v = avs_new_value_error("VMAF2: only 8..10-bit input supported.");
-    if (!avs_defined(v) && avs_is_rgb(&fi->vi))
-        v = avs_new_value_error("VMAF2: RGB color family is not supported.");
-    if (!avs_defined(v) && !avs_is_planar(&fi->vi))
+    if (!avs_is_planar(&fi->vi))
         v = avs_new_value_error("VMAF2: only planar format supported.");
     if (!avs_defined(v) && avs_num_components(&fi->vi) < 3)
         v = avs_new_value_error("VMAF2: minimum three planes are required.");
-
-    const bool is420 = avs_is_420(&fi->vi);
-    const bool is422 = avs_is_422(&fi->vi);
-    const bool is444 = avs_is_444(&fi->vi);
-
-    if (!avs_defined(v) && !(is420 || is422 || is444))
+    if (!avs_defined(v) && !vmaf_is_supported(&fi->vi))
         v = avs_new_value_error("VMAF2: only 420/422/444 chroma subsampling is supported.");
 
+    VMAFMatrix coefficients;
+
+    if (!avs_defined(v) && !vmaf_get_matrix(matrix, 8, 8, &coefficients))
+        v = avs_new_value_error("VMAF2: matrix must be rec601, rec709, rec2020, pc.601, pc.709 or pc.2020.");
+    if (!avs_defined(v) && !scale.empty() && scale != "bicubic" && scale != "lanczos")
+        v = avs_new_value_error("VMAF2: scale must be bicubic or lanczos.");
+    if (!avs_defined(v) && params->threads < 0)
+        v = avs_new_value_error("VMAF2: threads must be greater than or equal to 0.");
+    if (!avs_defined(v) && params->cpumask < 0)
+        v = avs_new_value_error("VMAF2: cpumask must be greater than or equal to 0.");
+    if (!avs_defined(v) && avs_defined(avs_array_elt(args, 10)) && threadWeight <= 0.0)
+        v = avs_new_value_error("VMAF2: thread_weight must be greater than 0.");
+    if (!avs_defined(v) && avs_defined(avs_array_elt(args, 4)) && avs_defined(avs_array_elt(args, 10)))
+        v = avs_new_value_error("VMAF2: thread_weight cannot be used with threads.");
+    if (!avs_defined(v) && avs_defined(avs_array_elt(args, 9)))
+    {
+        if (FILE* file = fopen(avs_as_string(avs_array_elt(args, 9)), "w"))
+            params->timing->trace = std::make_unique<VMAFTrace>(file, "VMAF2 (libvmaf threads: " + ((avs_defined(avs_array_elt(args, 10))) ? "shared"s : std::to_string(params->threads)) + ")");
+        else
+            v = avs_new_value_error("VMAF2: cannot open trace_path.");
+    }
+
     if (!avs_defined(v))
     {
         if (params->numFeature > 0)
@@ -225,10 +374,21 @@ AVS_Value AVSC_CC Create_VMAF2(AVS_ScriptEnvironment* env, AVS_Value args, void*
                 params->distorted = avs_take_clip(avs_array_elt(args, 1), env);
                 const AVS_VideoInfo* vi1 = avs_get_video_info(params->distorted);
 
-                if (!avs_is_same_colorspace(&fi->vi, vi1))
-                    v = avs_new_value_error("VMAF2: both clips must be the same format.");
-                if (!avs_defined(v) && fi->vi.width != vi1->width || fi->vi.height != vi1->height)
+                // The chroma subsampling may differ, the clip with the higher chroma resolution is downsampled.
+                if (!vmaf_is_supported(vi1))
+                    v = avs_new_value_error("VMAF2: distorted must be in YUV 420/422/444 or RGB planar format.");
+                if (!avs_defined(v) && avs_bits_per_component(&fi->vi) != avs_bits_per_component(vi1))
+                    v = avs_new_value_error("VMAF2: both clips must have the same bit depth.");
+                if (!avs_defined(v) && scale.empty() && (fi->vi.width != vi1->width || fi->vi.height != vi1->height))
                     v = avs_new_value_error("VMAF2: both clips must have the same dimensions.");
+                if (!avs_defined(v) && !scale.empty())
+                {
+                    // The distorted clip is brought to the chroma subsampling of the pictures before resizing.
+                    const VmafPixelFormat pixelFormat = vmaf_picture_format(&fi->vi, vi1);
+
+                    if ((pixelFormat != VMAF_PIX_FMT_YUV444P && vi1->width % 2) || (pixelFormat == VMAF_PIX_FMT_YUV420P && vi1->height % 2))
+                        v = avs_new_value_error("VMAF2: distorted dimensions must be divisible by the chroma subsampling of reference.");
+                }
                 if (!avs_defined(v) && fi->vi.num_frames != vi1->num_frames)
                     v = avs_new_value_error("VMAF2: both clips' number of frames don't match.");
             }
@@ -274,6 +434,9 @@ AVS_Value AVSC_CC Create_VMAF2(AVS_ScriptEnvironment* env, AVS_Value args, void*
                     break;
             }
 
+            if (params->feature[i] == 0 || params->feature[i] == 1 || params->feature[i] == 4)
+                params->chroma = true;
+
             if (!avs_defined(v) && params->feature[i] == 5)
             {
                 if (params->feature.size() > 1)
@@ -282,9 +445,8 @@ AVS_Value AVSC_CC Create_VMAF2(AVS_ScriptEnvironment* env, AVS_Value args, void*
                 if (!avs_defined(v))
                 {
                     params->distorted = avs_take_clip(avs_array_elt(args, 0), env);
-                    params->f = avs_defined(avs_array_elt(args, 3));
 
-                    if (params->f)
+                    if (avs_defined(avs_array_elt(args, 3)))
                     {
                         std::regex reg(R"((\w+)=([^ >]+)(?: (\w+)(?:=([^ >]+)))?(?: (\w+)(?:=([^ >]+)))?(?: (\w+)(?:=([^ >]+)))?(?: (\w+)(?:=([^ >]+)))?(?: (\w+)(?:=([^ >]+)))?(?: (\w+)(?:=([^ >]+)))?(?: (\w+)(?:=([^ >]+)))?)");
                         std::string cambi_opt = avs_as_string(avs_array_elt(args, 3));
@@ -293,10 +455,6 @@ AVS_Value AVSC_CC Create_VMAF2(AVS_ScriptEnvironment* env, AVS_Value args, void*
                         if (!std::regex_match(cambi_opt.cbegin(), cambi_opt.cend(), match, reg))
                             v = avs_new_value_error("VMAF2: cannot parse cambi_opt.");
 
-                        params->match.reserve(match.size());
-                        for (std::string match : match)
-                            params->match.emplace_back(match);
-
                         if (!avs_defined(v))
                         {
                             std::vector<int> unique_name;
@@ -434,6 +592,13 @@ AVS_Value AVSC_CC Create_VMAF2(AVS_ScriptEnvironment* env, AVS_Value args, void*
                                     break;
                             }
                         }
+
+                        // Only the validated name/value pairs are kept, every new context builds its dictionary from them.
+                        if (!avs_defined(v))
+                        {
+                            for (int i = 1; match[i + 1].matched; i += 2)
+                                params->cambiOpt.emplace_back(match[i].str(), match[i + 1].str());
+                        }
                     }
                 }
             }
@@ -447,12 +612,43 @@ AVS_Value AVSC_CC Create_VMAF2(AVS_ScriptEnvironment* env, AVS_Value args, void*
 
     if (!avs_defined(v))
     {
-        if (is420)
-            params->pixelFormat = VMAF_PIX_FMT_YUV420P;
-        else if (is422)
-            params->pixelFormat = VMAF_PIX_FMT_YUV422P;
+        const AVS_VideoInfo* vi1 = avs_get_video_info(params->distorted);
+
+        params->pixelFormat = vmaf_picture_format(&fi->vi, vi1);
+        params->refInput = vmaf_input(&fi->vi, params->pixelFormat, matrix);
+        params->distInput = vmaf_input(vi1, params->pixelFormat, matrix);
+        params->convert = vmaf_get_convert(avs_get_cpu_flags(env));
+
+        // The distorted frames are resized to the pictures (the reference dimensions).
+        if (fi->vi.width != vi1->width || fi->vi.height != vi1->height)
+        {
+            vmaf_init_resize(&params->resize, scale, vi1, fi->vi.width, fi->vi.height, params->pixelFormat);
+            params->distInput.resize = params->resize.data();
+        }
+
+        // Scores of bit-identical frames: psnr is capped by libvmaf at 6 * bits + 12 dB, (ms-)ssim is 1.
+        // psnr_hvs and ciede2000 have no finite value for identical frames, then every frame goes to libvmaf.
+        // Clips of different formats or dimensions are never compared.
+        if (avs_is_same_colorspace(&fi->vi, vi1) && !params->distInput.resize && std::all_of(params->feature.begin(), params->feature.end(), [](int f) { return f == 0 || f == 2 || f == 3; }))
+        {
+            params->identicalScore.reserve(params->featureN.size());
+
+            for (int i = 0; i < params->numFeature; ++i)
+            {
+                if (params->feature[i] == 0)
+                    params->identicalScore.insert(params->identicalScore.end(), 3, 6.0 * vmaf_picture_bits(&fi->vi) + 12.0);
+                else
+                    params->identicalScore.emplace_back(1.0);
+            }
+        }
+
+        // With thread_weight the share is taken for every frame.
+        if (avs_defined(avs_array_elt(args, 10)))
+            params->threadWeight = threadWeight;
         else
-            params->pixelFormat = VMAF_PIX_FMT_YUV444P;
+            params->threadsReserved = params->threads;
+
+        vmaf_budget_join(params->threadWeight, params->threadsReserved);
 
         v = avs_new_value_clip(clip);
     }
@@ -0,0 +1,513 @@
+#include <cmath>
+
+#include "VMAF.h"
+
+void vmaf_shift_row_c(const uint16_t *srcp, uint16_t *dstp, int width, int shift, int peak)
+{
+    // Same rounding as ((x + (1 << (shift - 1))) >> shift), the SIMD versions average (x >> (shift - 1)) with 0 to stay in 16 bits.
+    for (int x = 0; x < width; ++x)
+        dstp[x] = static_cast<uint16_t>(std::min(((srcp[x] >> (shift - 1)) + 1) >> 1, peak));
+}
+
+void vmaf_scale_row_c(const float *srcp, uint16_t *dstp, int width, float scale, float offset, int peak)
+{
+    for (int x = 0; x < width; ++x)
+        dstp[x] = static_cast<uint16_t>(std::clamp(static_cast<int>(std::lrintf(srcp[x] * scale + offset)), 0, peak));
+}
+
+template <typename T>
+static inline T vmaf_avg(T a, T b)
+{
+    return static_cast<T>((a + b + 1) >> 1);
+}
+
+// Chroma siting is left (MPEG-2): horizontally [1 2 1] centered on the even sample, computed as avg(avg(x[-1], x[1]), x[0])
+// so that every SIMD version gives the same result, vertically the average of the two rows.
+template <typename T>
+static void vmaf_downsample_row(const T *row0, const T *row1, T *dstp, int x, int width, int subX)
+{
+    if (!subX)
+    {
+        for (; x < width; ++x)
+            dstp[x] = vmaf_avg(row0[x], row1[x]);
+
+        return;
+    }
+
+    for (; x < width; ++x)
+    {
+        const int left = (x) ? 2 * x - 1 : 1;
+        dstp[x] = vmaf_avg(vmaf_avg(vmaf_avg(row0[left], row1[left]), vmaf_avg(row0[2 * x + 1], row1[2 * x + 1])), vmaf_avg(row0[2 * x], row1[2 * x]));
+    }
+}
+
+void vmaf_downsample8_c(const uint8_t *row0, const uint8_t *row1, uint8_t *dstp, int width, int subX)
+{
+    vmaf_downsample_row(row0, row1, dstp, 0, width, subX);
+}
+
+void vmaf_downsample16_c(const uint16_t *row0, const uint16_t *row1, uint16_t *dstp, int width, int subX)
+{
+    vmaf_downsample_row(row0, row1, dstp, 0, width, subX);
+}
+
+void vmaf_downsample8_tail(const uint8_t *row0, const uint8_t *row1, uint8_t *dstp, int x, int width, int subX)
+{
+    vmaf_downsample_row(row0, row1, dstp, x, width, subX);
+}
+
+void vmaf_downsample16_tail(const uint16_t *row0, const uint16_t *row1, uint16_t *dstp, int x, int width, int subX)
+{
+    vmaf_downsample_row(row0, row1, dstp, x, width, subX);
+}
+
+template <typename T, typename O>
+static void vmaf_rgb_row(const uint8_t *const *srcp, uint8_t *const *dstp, int x, int width, const VMAFMatrix *matrix)
+{
+    const T *r = reinterpret_cast<const T *>(srcp[0]);
+    const T *g = reinterpret_cast<const T *>(srcp[1]);
+    const T *b = reinterpret_cast<const T *>(srcp[2]);
+    const int planes = (dstp[1]) ? 3 : 1;
+
+    for (; x < width; ++x)
+    {
+        const float rv = static_cast<float>(r[x]);
+        const float gv = static_cast<float>(g[x]);
+        const float bv = static_cast<float>(b[x]);
+
+        for (int i = 0; i < planes; ++i)
+        {
+            const float v = matrix->m[i][0] * rv + matrix->m[i][1] * gv + matrix->m[i][2] * bv + matrix->offset[i];
+            reinterpret_cast<O *>(dstp[i])[x] = static_cast<O>(std::clamp(static_cast<int>(std::lrintf(v)), 0, matrix->peak));
+        }
+    }
+}
+
+void vmaf_rgb_row_tail(const uint8_t *const *srcp, uint8_t *const *dstp, int x, int width, int bits, int bpc, const VMAFMatrix *matrix)
+{
+    if (bits == 8)
+        (bpc == 8) ? vmaf_rgb_row<uint8_t, uint8_t>(srcp, dstp, x, width, matrix) : vmaf_rgb_row<uint8_t, uint16_t>(srcp, dstp, x, width, matrix);
+    else if (bits == 32)
+        (bpc == 8) ? vmaf_rgb_row<float, uint8_t>(srcp, dstp, x, width, matrix) : vmaf_rgb_row<float, uint16_t>(srcp, dstp, x, width, matrix);
+    else
+        (bpc == 8) ? vmaf_rgb_row<uint16_t, uint8_t>(srcp, dstp, x, width, matrix) : vmaf_rgb_row<uint16_t, uint16_t>(srcp, dstp, x, width, matrix);
+}
+
+void vmaf_rgb_row_c(const uint8_t *const *srcp, uint8_t *const *dstp, int width, int bits, int bpc, const VMAFMatrix *matrix)
+{
+    vmaf_rgb_row_tail(srcp, dstp, 0, width, bits, bpc, matrix);
+}
+
+bool vmaf_get_matrix(const std::string &name, int bits, int bpc, VMAFMatrix *matrix)
+{
+    std::string n = name;
+    std::transform(n.begin(), n.end(), n.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+    const bool full = !n.compare(0, 3, "pc.");
+    const std::string standard = n.substr((full) ? 3 : (!n.compare(0, 3, "rec")) ? 3 : n.size());
+
+    double kr, kb;
+
+    if (standard == "601")
+        kr = 0.299, kb = 0.114;
+    else if (standard == "709")
+        kr = 0.2126, kb = 0.0722;
+    else if (standard == "2020")
+        kr = 0.2627, kb = 0.0593;
+    else
+        return false;
+
+    const double kg = 1.0 - kr - kb;
+    const int peak = (1 << bpc) - 1;
+    // The clip's samples normalized to 0..1 (float RGB already is).
+    const double in = (bits == 32) ? 1.0 : 1.0 / ((1 << bits) - 1);
+    const double yScale = ((full) ? peak : 219 << (bpc - 8)) * in;
+    const double cScale = ((full) ? peak : 224 << (bpc - 8)) * in;
+
+    const double m[3][3] = {
+        {kr * yScale, kg * yScale, kb * yScale},
+        {-kr / (2.0 * (1.0 - kb)) * cScale, -kg / (2.0 * (1.0 - kb)) * cScale, 0.5 * cScale},
+        {0.5 * cScale, -kg / (2.0 * (1.0 - kr)) * cScale, -kb / (2.0 * (1.0 - kr)) * cScale}};
+
+    for (int i = 0; i < 3; ++i)
+    {
+        for (int j = 0; j < 3; ++j)
+            matrix->m[i][j] = static_cast<float>(m[i][j]);
+    }
+
+    matrix->offset[0] = static_cast<float>((full) ? 0 : 16 << (bpc - 8));
+    matrix->offset[1] = matrix->offset[2] = static_cast<float>(1 << (bpc - 1));
+    matrix->peak = peak;
+
+    return true;
+}
+
+template <typename T>
+static void vmaf_resize_h(const uint8_t *srcp, uint16_t *dstp, int x, int width, int taps, const int *left, const int32_t *coef, int peak)
+{
+    const T *src = reinterpret_cast<const T *>(srcp);
+
+    for (; x < width; ++x)
+    {
+        int sum = 0;
+        for (int k = 0; k < taps; ++k)
+            sum += coef[k * width + x] * src[left[x] + k];
+
+        dstp[x] = static_cast<uint16_t>(std::clamp((sum + 8192) >> 14, 0, peak));
+    }
+}
+
+void vmaf_resize_h_tail(const uint8_t *srcp, uint16_t *dstp, int x, int width, int taps, const int *left, const int32_t *coef, int bpc, int peak)
+{
+    if (bpc == 8)
+        vmaf_resize_h<uint8_t>(srcp, dstp, x, width, taps, left, coef, peak);
+    else
+        vmaf_resize_h<uint16_t>(srcp, dstp, x, width, taps, left, coef, peak);
+}
+
+void vmaf_resize_h_c(const uint8_t *srcp, uint16_t *dstp, int width, int taps, const int *left, const int32_t *coef, int bpc, int peak)
+{
+    vmaf_resize_h_tail(srcp, dstp, 0, width, taps, left, coef, bpc, peak);
+}
+
+template <typename T>
+static void vmaf_resize_v(const uint16_t *const *rows, uint8_t *dstp, int x, int width, int taps, const int32_t *coef, int peak)
+{
+    T *dst = reinterpret_cast<T *>(dstp);
+
+    for (; x < width; ++x)
+    {
+        int sum = 0;
+        for (int k = 0; k < taps; ++k)
+            sum += coef[k] * rows[k][x];
+
+        dst[x] = static_cast<T>(std::clamp((sum + 8192) >> 14, 0, peak));
+    }
+}
+
+void vmaf_resize_v_tail(const uint16_t *const *rows, uint8_t *dstp, int x, int width, int taps, const int32_t *coef, int bpc, int peak)
+{
+    if (bpc == 8)
+        vmaf_resize_v<uint8_t>(rows, dstp, x, width, taps, coef, peak);
+    else
+        vmaf_resize_v<uint16_t>(rows, dstp, x, width, taps, coef, peak);
+}
+
+void vmaf_resize_v_c(const uint16_t *const *rows, uint8_t *dstp, int width, int taps, const int32_t *coef, int bpc, int peak)
+{
+    vmaf_resize_v_tail(rows, dstp, 0, width, taps, coef, bpc, peak);
+}
+
+// Mitchell-Netravali with b = c = 1/3 (the default of BicubicResize).
+static double vmaf_bicubic(double x)
+{
+    constexpr double b = 1.0 / 3.0;
+    constexpr double c = 1.0 / 3.0;
+    x = std::abs(x);
+
+    if (x < 1.0)
+        return ((12.0 - 9.0 * b - 6.0 * c) * x * x * x + (-18.0 + 12.0 * b + 6.0 * c) * x * x + (6.0 - 2.0 * b)) / 6.0;
+    if (x < 2.0)
+        return ((-b - 6.0 * c) * x * x * x + (6.0 * b + 30.0 * c) * x * x + (-12.0 * b - 48.0 * c) * x + (8.0 * b + 24.0 * c)) / 6.0;
+
+    return 0.0;
+}
+
+static double vmaf_sinc(double x)
+{
+    constexpr double pi = 3.14159265358979323846;
+    return (x == 0.0) ? 1.0 : std::sin(pi * x) / (pi * x);
+}
+
+static double vmaf_lanczos(double x)
+{
+    return (std::abs(x) < 3.0) ? vmaf_sinc(x) * vmaf_sinc(x / 3.0) : 0.0;
+}
+
+// Center aligned, the filter is stretched when downscaling. Taps outside the plane are folded onto the edge samples,
+// so every output position reads taps consecutive samples from left. The coefficients of a position sum to 1 << 14.
+static void vmaf_resize_coefficients(double (*filter)(double), double support, int src, int dst, int *taps, std::vector<int> &left, std::vector<int32_t> &coef)
+{
+    const double ratio = static_cast<double>(src) / dst;
+    const double stretch = std::max(ratio, 1.0);
+    *taps = std::min(static_cast<int>(std::ceil(support * stretch)) * 2, src);
+
+    left.resize(dst);
+    coef.assign(static_cast<size_t>(dst) * *taps, 0);
+    std::vector<double> weight(*taps);
+
+    for (int i = 0; i < dst; ++i)
+    {
+        const double center = (i + 0.5) * ratio - 0.5;
+        const int start = static_cast<int>(std::floor(center - support * stretch)) + 1;
+        left[i] = std::clamp(start, 0, src - *taps);
+
+        std::fill(weight.begin(), weight.end(), 0.0);
+        double sum = 0.0;
+
+        for (int j = start; j < start + static_cast<int>(std::ceil(support * stretch)) * 2; ++j)
+        {
+            const double w = filter((j - center) / stretch);
+            weight[std::clamp(j, 0, src - 1) - left[i]] += w;
+            sum += w;
+        }
+
+        int total = 0;
+        int largest = 0;
+
+        for (int k = 0; k < *taps; ++k)
+        {
+            coef[static_cast<size_t>(i) * *taps + k] = static_cast<int32_t>(std::lrint(weight[k] / sum * 16384.0));
+            total += coef[static_cast<size_t>(i) * *taps + k];
+
+            if (weight[k] > weight[largest])
+                largest = k;
+        }
+
+        coef[static_cast<size_t>(i) * *taps + largest] += 16384 - total;
+    }
+}
+
+bool vmaf_init_resize(VMAFResizePlane *resize, const std::string &kernel, int srcWidth, int srcHeight, int dstWidth, int dstHeight)
+{
+    double (*filter)(double);
+    double support;
+
+    if (kernel == "bicubic")
+        filter = vmaf_bicubic, support = 2.0;
+    else if (kernel == "lanczos")
+        filter = vmaf_lanczos, support = 3.0;
+    else
+        return false;
+
+    resize->srcWidth = srcWidth;
+    resize->srcHeight = srcHeight;
+    resize->dstWidth = dstWidth;
+    resize->dstHeight = dstHeight;
+
+    std::vector<int32_t> coef;
+    vmaf_resize_coefficients(filter, support, srcWidth, dstWidth, &resize->tapsH, resize->leftH, coef);
+
+    // The horizontal kernels load the coefficient k of consecutive positions.
+    resize->coefH.resize(coef.size());
+    for (int x = 0; x < dstWidth; ++x)
+    {
+        for (int k = 0; k < resize->tapsH; ++k)
+            resize->coefH[static_cast<size_t>(k) * dstWidth + x] = coef[static_cast<size_t>(x) * resize->tapsH + k];
+    }
+
+    vmaf_resize_coefficients(filter, support, srcHeight, dstHeight, &resize->tapsV, resize->leftV, resize->coefV);
+
+    return true;
+}
+
+bool vmaf_init_resize(std::vector<VMAFResizePlane> *resize, const std::string &kernel, const AVS_VideoInfo *vi, int width, int height, VmafPixelFormat pixelFormat)
+{
+    const int subX = (pixelFormat != VMAF_PIX_FMT_YUV444P) ? 1 : 0;
+    const int subY = (pixelFormat == VMAF_PIX_FMT_YUV420P) ? 1 : 0;
+    resize->resize(3);
+
+    for (int plane = 0; plane < 3; ++plane)
+    {
+        const int sx = (plane) ? subX : 0;
+        const int sy = (plane) ? subY : 0;
+
+        if (!vmaf_init_resize(&(*resize)[plane], kernel, vi->width >> sx, vi->height >> sy, width >> sx, height >> sy))
+            return false;
+    }
+
+    return true;
+}
+
+void vmaf_resize_plane(const VMAFConvert *convert, const VMAFResizePlane &resize, const uint8_t *srcp, ptrdiff_t srcStride, uint8_t *dstp, ptrdiff_t dstStride, int bpc)
+{
+    const int peak = (1 << bpc) - 1;
+    thread_local std::vector<uint16_t> buf;
+    buf.resize(static_cast<size_t>(resize.dstWidth) * resize.srcHeight);
+
+    for (int y = 0; y < resize.srcHeight; ++y)
+        convert->resizeH(srcp + y * srcStride, buf.data() + static_cast<size_t>(y) * resize.dstWidth, resize.dstWidth, resize.tapsH, resize.leftH.data(), resize.coefH.data(), bpc, peak);
+
+    std::vector<const uint16_t *> rows(resize.tapsV);
+
+    for (int y = 0; y < resize.dstHeight; ++y)
+    {
+        for (int k = 0; k < resize.tapsV; ++k)
+            rows[k] = buf.data() + static_cast<size_t>(resize.leftV[y] + k) * resize.dstWidth;
+
+        convert->resizeV(rows.data(), dstp + y * dstStride, resize.dstWidth, resize.tapsV, resize.coefV.data() + static_cast<size_t>(y) * resize.tapsV, bpc, peak);
+    }
+}
+
+const VMAFConvert *vmaf_get_convert(int cpuFlags)
+{
+    static constexpr VMAFConvert c{
+        vmaf_shift_row_c, vmaf_scale_row_c, vmaf_downsample8_c, vmaf_downsample16_c, vmaf_rgb_row_c, vmaf_resize_h_c, vmaf_resize_v_c};
+    static constexpr VMAFConvert avx2{
+        vmaf_shift_row_avx2, vmaf_scale_row_avx2, vmaf_downsample8_avx2, vmaf_downsample16_avx2, vmaf_rgb_row_avx2, vmaf_resize_h_avx2, vmaf_resize_v_avx2};
+    static constexpr VMAFConvert avx512{vmaf_shift_row_avx512, vmaf_scale_row_avx512, vmaf_downsample8_avx512, vmaf_downsample16_avx512, vmaf_rgb_row_avx512,
+        vmaf_resize_h_avx512, vmaf_resize_v_avx512};
+
+    // convert_AVX512.cpp is built with -mavx512f -mavx512bw -mavx512dq -mavx512vl.
+    constexpr int avx512Flags = AVS_CPUF_AVX512F | AVS_CPUF_AVX512BW | AVS_CPUF_AVX512DQ | AVS_CPUF_AVX512VL;
+
+    if ((cpuFlags & avx512Flags) == avx512Flags)
+        return &avx512;
+    if (cpuFlags & AVS_CPUF_AVX2)
+        return &avx2;
+
+    return &c;
+}
+
+// A row of the clip's samples as samples of the picture, converted into buf when the bit depths differ.
+static const uint8_t *vmaf_picture_row(const VMAFConvert *convert, const uint8_t *srcp, uint16_t *buf, int width, int bits, int bpc, bool chroma)
+{
+    if (bits == bpc)
+        return srcp;
+
+    const int peak = (1 << bpc) - 1;
+
+    // Float chroma is centered at 0.
+    if (bits == 32)
+        convert->scale(reinterpret_cast<const float *>(srcp), buf, width, static_cast<float>(peak), (chroma) ? static_cast<float>((peak + 1) / 2) : 0.0f, peak);
+    else
+        convert->shift(reinterpret_cast<const uint16_t *>(srcp), buf, width, bits - bpc, peak);
+
+    return reinterpret_cast<const uint8_t *>(buf);
+}
+
+// Y, U, V come from the same r, g, b rows, so the rows are converted once for all planes. When the chroma is subsampled,
+// U, V rows go to buf first and are downsampled after every second (or every) row.
+static void vmaf_write_rgb(const VMAFConvert *convert, VmafPicture *pic, AVS_VideoFrame *frame, const VMAFInput &input, bool chroma)
+{
+    const int pl[3] = {AVS_PLANAR_R, AVS_PLANAR_G, AVS_PLANAR_B};
+    const int width = pic->w[0];
+    const bool sub = input.subX || input.subY;
+    const size_t size = static_cast<size_t>(width) * ((pic->bpc == 8) ? 1 : 2);
+    std::vector<uint8_t> buf((chroma && sub) ? size * 4 : 0);
+
+    for (unsigned y = 0; y < pic->h[0]; ++y)
+    {
+        const uint8_t *srcp[3];
+        for (int i = 0; i < 3; ++i)
+            srcp[i] = avs_get_read_ptr_p(frame, pl[i]) + static_cast<ptrdiff_t>(y) * avs_get_pitch_p(frame, pl[i]);
+
+        uint8_t *dstp[3] = {reinterpret_cast<uint8_t *>(pic->data[0]) + y * pic->stride[0], nullptr, nullptr};
+
+        if (chroma)
+        {
+            for (int i = 1; i < 3; ++i)
+                dstp[i] = (sub) ? buf.data() + size * (2 * (i - 1) + (y & input.subY)) : reinterpret_cast<uint8_t *>(pic->data[i]) + y * pic->stride[i];
+        }
+
+        convert->rgb(srcp, dstp, width, input.bits, pic->bpc, &input.matrix);
+
+        if (chroma && sub && (y & input.subY) == static_cast<unsigned>(input.subY))
+        {
+            for (int i = 1; i < 3; ++i)
+            {
+                const uint8_t *row0 = buf.data() + size * 2 * (i - 1);
+                const uint8_t *row1 = row0 + size * input.subY;
+                uint8_t *dst = reinterpret_cast<uint8_t *>(pic->data[i]) + (y >> input.subY) * pic->stride[i];
+
+                if (pic->bpc == 8)
+                    convert->downsample8(row0, row1, dst, pic->w[i], input.subX);
+                else
+                    convert->downsample16(reinterpret_cast<const uint16_t *>(row0), reinterpret_cast<const uint16_t *>(row1), reinterpret_cast<uint16_t *>(dst), pic->w[i], input.subX);
+            }
+        }
+    }
+}
+
+void vmaf_write_picture(AVS_ScriptEnvironment *env, const VMAFConvert *convert, VmafPicture *pic, AVS_VideoFrame *frame, const VMAFInput &input, bool chroma)
+{
+    // The frame is written at its own size first (in the format of the picture), then resized into the picture.
+    if (input.resize)
+    {
+        const int bytes = (pic->bpc == 8) ? 1 : 2;
+        thread_local std::vector<uint8_t> buf;
+
+        VmafPicture src{};
+        src.pix_fmt = pic->pix_fmt;
+        src.bpc = pic->bpc;
+
+        size_t size = 0;
+        for (int plane = 0; plane < 3; ++plane)
+        {
+            src.w[plane] = input.resize[plane].srcWidth;
+            src.h[plane] = input.resize[plane].srcHeight;
+            // Padded for the horizontal resize kernels.
+            src.stride[plane] = (static_cast<ptrdiff_t>(src.w[plane]) * bytes + 127) & ~static_cast<ptrdiff_t>(63);
+            size += src.stride[plane] * src.h[plane];
+        }
+
+        buf.resize(size);
+        src.data[0] = buf.data();
+        src.data[1] = reinterpret_cast<uint8_t *>(src.data[0]) + src.stride[0] * src.h[0];
+        src.data[2] = reinterpret_cast<uint8_t *>(src.data[1]) + src.stride[1] * src.h[1];
+
+        VMAFInput direct = input;
+        direct.resize = nullptr;
+        vmaf_write_picture(env, convert, &src, frame, direct, chroma);
+
+        for (int plane = 0; plane < ((chroma) ? 3 : 1); ++plane)
+            vmaf_resize_plane(convert, input.resize[plane], reinterpret_cast<const uint8_t *>(src.data[plane]), src.stride[plane],
+                reinterpret_cast<uint8_t *>(pic->data[plane]), pic->stride[plane], pic->bpc);
+
+        return;
+    }
+
+    if (input.rgb)
+    {
+        vmaf_write_rgb(convert, pic, frame, input, chroma);
+        return;
+    }
+
+    const int pl[3] = {AVS_PLANAR_Y, AVS_PLANAR_U, AVS_PLANAR_V};
+    std::vector<uint16_t> buf;
+
+    for (int plane = 0; plane < ((chroma) ? 3 : 1); ++plane)
+    {
+        const int subX = (plane) ? input.subX : 0;
+        const int subY = (plane) ? input.subY : 0;
+
+        if (input.bits == static_cast<int>(pic->bpc) && !subX && !subY)
+        {
+            vmaf_copy_plane(env, pic, plane, frame, pl[plane]);
+            continue;
+        }
+
+        const uint8_t *srcp = avs_get_read_ptr_p(frame, pl[plane]);
+        const int pitch = avs_get_pitch_p(frame, pl[plane]);
+        const int width = pic->w[plane];
+        const int srcWidth = width << subX;
+        uint8_t *dstp = reinterpret_cast<uint8_t *>(pic->data[plane]);
+
+        if (input.bits != static_cast<int>(pic->bpc) && buf.empty())
+            buf.resize(static_cast<size_t>(srcWidth) * 2);
+
+        for (unsigned y = 0; y < pic->h[plane]; ++y)
+        {
+            if (!subX && !subY)
+            {
+                // Converted straight into the picture.
+                vmaf_picture_row(convert, srcp, reinterpret_cast<uint16_t *>(dstp), width, input.bits, pic->bpc, plane);
+                srcp += pitch;
+            }
+            else
+            {
+                const uint8_t *row0 = vmaf_picture_row(convert, srcp, buf.data(), srcWidth, input.bits, pic->bpc, plane);
+                const uint8_t *row1 = (subY) ? vmaf_picture_row(convert, srcp + pitch, buf.data() + srcWidth, srcWidth, input.bits, pic->bpc, plane) : row0;
+
+                if (pic->bpc == 8)
+                    convert->downsample8(row0, row1, dstp, width, subX);
+                else
+                    convert->downsample16(reinterpret_cast<const uint16_t *>(row0), reinterpret_cast<const uint16_t *>(row1), reinterpret_cast<uint16_t *>(dstp), width, subX);
+
+                srcp += static_cast<ptrdiff_t>(pitch) << subY;
+            }
+
+            dstp += pic->stride[plane];
+        }
+    }
+}
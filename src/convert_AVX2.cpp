@@ -0,0 +1,257 @@
+#include <immintrin.h>
+
+#include "VMAF.h"
+
+void vmaf_shift_row_avx2(const uint16_t *srcp, uint16_t *dstp, int width, int shift, int peak)
+{
+    const __m128i count = _mm_cvtsi32_si128(shift - 1);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i max = _mm256_set1_epi16(static_cast<short>(peak));
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(srcp + x));
+        v = _mm256_avg_epu16(_mm256_srl_epi16(v, count), zero);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dstp + x), _mm256_min_epu16(v, max));
+    }
+
+    vmaf_shift_row_c(srcp + x, dstp + x, width - x, shift, peak);
+}
+
+void vmaf_scale_row_avx2(const float *srcp, uint16_t *dstp, int width, float scale, float offset, int peak)
+{
+    const __m256 mul = _mm256_set1_ps(scale);
+    const __m256 add = _mm256_set1_ps(offset);
+    const __m256i min = _mm256_setzero_si256();
+    const __m256i max = _mm256_set1_epi32(peak);
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        // No fma - the results must match the C version.
+        __m256i lo = _mm256_cvtps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(srcp + x), mul), add));
+        __m256i hi = _mm256_cvtps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(srcp + x + 8), mul), add));
+        lo = _mm256_min_epi32(_mm256_max_epi32(lo, min), max);
+        hi = _mm256_min_epi32(_mm256_max_epi32(hi, min), max);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dstp + x), _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xD8));
+    }
+
+    vmaf_scale_row_c(srcp + x, dstp + x, width - x, scale, offset, peak);
+}
+
+void vmaf_downsample8_avx2(const uint8_t *row0, const uint8_t *row1, uint8_t *dstp, int width, int subX)
+{
+    int x = 0;
+
+    if (!subX)
+    {
+        for (; x + 32 <= width; x += 32)
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dstp + x),
+                _mm256_avg_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(row0 + x)), _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row1 + x))));
+    }
+    else
+    {
+        // The first sample mirrors its left neighbour.
+        vmaf_downsample8_tail(row0, row1, dstp, 0, std::min(width, 1), subX);
+
+        const __m256i mask = _mm256_set1_epi16(0x00FF);
+
+        auto load = [&](int i) {
+            return _mm256_avg_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(row0 + i)), _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row1 + i)));
+        };
+        auto even = [&](__m256i a, __m256i b) { return _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask)), 0xD8); };
+        auto odd = [&](__m256i a, __m256i b) { return _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8)), 0xD8); };
+
+        for (x = 1; x + 32 <= width; x += 32)
+        {
+            const __m256i left = odd(load(2 * x - 2), load(2 * x + 30));
+            const __m256i center0 = load(2 * x);
+            const __m256i center1 = load(2 * x + 32);
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dstp + x), _mm256_avg_epu8(_mm256_avg_epu8(left, odd(center0, center1)), even(center0, center1)));
+        }
+    }
+
+    vmaf_downsample8_tail(row0, row1, dstp, x, width, subX);
+}
+
+void vmaf_downsample16_avx2(const uint16_t *row0, const uint16_t *row1, uint16_t *dstp, int width, int subX)
+{
+    int x = 0;
+
+    if (!subX)
+    {
+        for (; x + 16 <= width; x += 16)
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dstp + x),
+                _mm256_avg_epu16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(row0 + x)), _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row1 + x))));
+    }
+    else
+    {
+        // The first sample mirrors its left neighbour.
+        vmaf_downsample16_tail(row0, row1, dstp, 0, std::min(width, 1), subX);
+
+        const __m256i mask = _mm256_set1_epi32(0xFFFF);
+
+        auto load = [&](int i) {
+            return _mm256_avg_epu16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(row0 + i)), _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row1 + i)));
+        };
+        auto even = [&](__m256i a, __m256i b) { return _mm256_permute4x64_epi64(_mm256_packus_epi32(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask)), 0xD8); };
+        auto odd = [&](__m256i a, __m256i b) { return _mm256_permute4x64_epi64(_mm256_packus_epi32(_mm256_srli_epi32(a, 16), _mm256_srli_epi32(b, 16)), 0xD8); };
+
+        for (x = 1; x + 16 <= width; x += 16)
+        {
+            const __m256i left = odd(load(2 * x - 2), load(2 * x + 14));
+            const __m256i center0 = load(2 * x);
+            const __m256i center1 = load(2 * x + 16);
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dstp + x), _mm256_avg_epu16(_mm256_avg_epu16(left, odd(center0, center1)), even(center0, center1)));
+        }
+    }
+
+    vmaf_downsample16_tail(row0, row1, dstp, x, width, subX);
+}
+
+static inline __m256 vmaf_load8(const uint8_t *srcp)
+{
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(srcp))));
+}
+
+static inline __m256 vmaf_load8(const uint16_t *srcp)
+{
+    return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(srcp))));
+}
+
+static inline __m256 vmaf_load8(const float *srcp)
+{
+    return _mm256_loadu_ps(srcp);
+}
+
+static inline void vmaf_store8(uint8_t *dstp, __m256i v)
+{
+    const __m128i w = _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi32(v, v), 0xD8));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(dstp), _mm_packus_epi16(w, w));
+}
+
+static inline void vmaf_store8(uint16_t *dstp, __m256i v)
+{
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dstp), _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi32(v, v), 0xD8)));
+}
+
+template <typename T, typename O>
+static int vmaf_rgb_avx2(const uint8_t *const *srcp, uint8_t *const *dstp, int width, const VMAFMatrix *matrix)
+{
+    const T *r = reinterpret_cast<const T *>(srcp[0]);
+    const T *g = reinterpret_cast<const T *>(srcp[1]);
+    const T *b = reinterpret_cast<const T *>(srcp[2]);
+    const int planes = (dstp[1]) ? 3 : 1;
+
+    __m256 m[3][3], offset[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        for (int j = 0; j < 3; ++j)
+            m[i][j] = _mm256_set1_ps(matrix->m[i][j]);
+
+        offset[i] = _mm256_set1_ps(matrix->offset[i]);
+    }
+
+    const __m256i min = _mm256_setzero_si256();
+    const __m256i max = _mm256_set1_epi32(matrix->peak);
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        const __m256 rv = vmaf_load8(r + x);
+        const __m256 gv = vmaf_load8(g + x);
+        const __m256 bv = vmaf_load8(b + x);
+
+        for (int i = 0; i < planes; ++i)
+        {
+            // Same order as the C version, no fma.
+            const __m256 v = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[i][0], rv), _mm256_mul_ps(m[i][1], gv)), _mm256_mul_ps(m[i][2], bv)), offset[i]);
+            vmaf_store8(reinterpret_cast<O *>(dstp[i]) + x, _mm256_min_epi32(_mm256_max_epi32(_mm256_cvtps_epi32(v), min), max));
+        }
+    }
+
+    return x;
+}
+
+void vmaf_rgb_row_avx2(const uint8_t *const *srcp, uint8_t *const *dstp, int width, int bits, int bpc, const VMAFMatrix *matrix)
+{
+    int x;
+
+    if (bits == 8)
+        x = (bpc == 8) ? vmaf_rgb_avx2<uint8_t, uint8_t>(srcp, dstp, width, matrix) : vmaf_rgb_avx2<uint8_t, uint16_t>(srcp, dstp, width, matrix);
+    else if (bits == 32)
+        x = (bpc == 8) ? vmaf_rgb_avx2<float, uint8_t>(srcp, dstp, width, matrix) : vmaf_rgb_avx2<float, uint16_t>(srcp, dstp, width, matrix);
+    else
+        x = (bpc == 8) ? vmaf_rgb_avx2<uint16_t, uint8_t>(srcp, dstp, width, matrix) : vmaf_rgb_avx2<uint16_t, uint16_t>(srcp, dstp, width, matrix);
+
+    vmaf_rgb_row_tail(srcp, dstp, x, width, bits, bpc, matrix);
+}
+
+template <typename T>
+static int vmaf_resize_h_avx2(const uint8_t *srcp, uint16_t *dstp, int width, int taps, const int *left, const int32_t *coef, int peak)
+{
+    const int *src = reinterpret_cast<const int *>(srcp);
+    const __m256i mask = _mm256_set1_epi32((sizeof(T) == 1) ? 0xFF : 0xFFFF);
+    const __m256i round = _mm256_set1_epi32(8192);
+    const __m256i min = _mm256_setzero_si256();
+    const __m256i max = _mm256_set1_epi32(peak);
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        const __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(left + x));
+        __m256i sum = round;
+
+        for (int k = 0; k < taps; ++k)
+        {
+            // The source rows are padded, the gather may read past the last sample.
+            const __m256i v = _mm256_and_si256(_mm256_i32gather_epi32(src, _mm256_add_epi32(idx, _mm256_set1_epi32(k)), sizeof(T)), mask);
+            sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(v, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(coef + k * width + x))));
+        }
+
+        sum = _mm256_min_epi32(_mm256_max_epi32(_mm256_srai_epi32(sum, 14), min), max);
+        vmaf_store8(dstp + x, sum);
+    }
+
+    return x;
+}
+
+void vmaf_resize_h_avx2(const uint8_t *srcp, uint16_t *dstp, int width, int taps, const int *left, const int32_t *coef, int bpc, int peak)
+{
+    const int x = (bpc == 8) ? vmaf_resize_h_avx2<uint8_t>(srcp, dstp, width, taps, left, coef, peak)
+                             : vmaf_resize_h_avx2<uint16_t>(srcp, dstp, width, taps, left, coef, peak);
+
+    vmaf_resize_h_tail(srcp, dstp, x, width, taps, left, coef, bpc, peak);
+}
+
+void vmaf_resize_v_avx2(const uint16_t *const *rows, uint8_t *dstp, int width, int taps, const int32_t *coef, int bpc, int peak)
+{
+    const __m256i round = _mm256_set1_epi32(8192);
+    const __m256i min = _mm256_setzero_si256();
+    const __m256i max = _mm256_set1_epi32(peak);
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        __m256i sum = round;
+
+        for (int k = 0; k < taps; ++k)
+        {
+            const __m256i v = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(rows[k] + x)));
+            sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(v, _mm256_set1_epi32(coef[k])));
+        }
+
+        sum = _mm256_min_epi32(_mm256_max_epi32(_mm256_srai_epi32(sum, 14), min), max);
+
+        if (bpc == 8)
+            vmaf_store8(dstp + x, sum);
+        else
+            vmaf_store8(reinterpret_cast<uint16_t *>(dstp) + x, sum);
+    }
+
+    vmaf_resize_v_tail(rows, dstp, x, width, taps, coef, bpc, peak);
+}
@@ -0,0 +1,249 @@
+#include <immintrin.h>
+
+#include "VMAF.h"
+
+void vmaf_shift_row_avx512(const uint16_t *srcp, uint16_t *dstp, int width, int shift, int peak)
+{
+    const __m128i count = _mm_cvtsi32_si128(shift - 1);
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i max = _mm512_set1_epi16(static_cast<short>(peak));
+
+    int x = 0;
+    for (; x + 32 <= width; x += 32)
+    {
+        __m512i v = _mm512_loadu_si512(srcp + x);
+        v = _mm512_avg_epu16(_mm512_srl_epi16(v, count), zero);
+        _mm512_storeu_si512(dstp + x, _mm512_min_epu16(v, max));
+    }
+
+    vmaf_shift_row_c(srcp + x, dstp + x, width - x, shift, peak);
+}
+
+void vmaf_scale_row_avx512(const float *srcp, uint16_t *dstp, int width, float scale, float offset, int peak)
+{
+    const __m512 mul = _mm512_set1_ps(scale);
+    const __m512 add = _mm512_set1_ps(offset);
+    const __m512i min = _mm512_setzero_si512();
+    const __m512i max = _mm512_set1_epi32(peak);
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        // No fma - the results must match the C version.
+        __m512i v = _mm512_cvtps_epi32(_mm512_add_ps(_mm512_mul_ps(_mm512_loadu_ps(srcp + x), mul), add));
+        v = _mm512_min_epi32(_mm512_max_epi32(v, min), max);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dstp + x), _mm512_cvtepi32_epi16(v));
+    }
+
+    vmaf_scale_row_c(srcp + x, dstp + x, width - x, scale, offset, peak);
+}
+
+void vmaf_downsample8_avx512(const uint8_t *row0, const uint8_t *row1, uint8_t *dstp, int width, int subX)
+{
+    int x = 0;
+
+    if (!subX)
+    {
+        for (; x + 64 <= width; x += 64)
+            _mm512_storeu_si512(dstp + x, _mm512_avg_epu8(_mm512_loadu_si512(row0 + x), _mm512_loadu_si512(row1 + x)));
+    }
+    else
+    {
+        // The first sample mirrors its left neighbour.
+        vmaf_downsample8_tail(row0, row1, dstp, 0, std::min(width, 1), subX);
+
+        const __m512i mask = _mm512_set1_epi16(0x00FF);
+        const __m512i order = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+
+        auto load = [&](int i) { return _mm512_avg_epu8(_mm512_loadu_si512(row0 + i), _mm512_loadu_si512(row1 + i)); };
+        auto even = [&](__m512i a, __m512i b) { return _mm512_permutexvar_epi64(order, _mm512_packus_epi16(_mm512_and_si512(a, mask), _mm512_and_si512(b, mask))); };
+        auto odd = [&](__m512i a, __m512i b) { return _mm512_permutexvar_epi64(order, _mm512_packus_epi16(_mm512_srli_epi16(a, 8), _mm512_srli_epi16(b, 8))); };
+
+        for (x = 1; x + 64 <= width; x += 64)
+        {
+            const __m512i left = odd(load(2 * x - 2), load(2 * x + 62));
+            const __m512i center0 = load(2 * x);
+            const __m512i center1 = load(2 * x + 64);
+
+            _mm512_storeu_si512(dstp + x, _mm512_avg_epu8(_mm512_avg_epu8(left, odd(center0, center1)), even(center0, center1)));
+        }
+    }
+
+    vmaf_downsample8_tail(row0, row1, dstp, x, width, subX);
+}
+
+void vmaf_downsample16_avx512(const uint16_t *row0, const uint16_t *row1, uint16_t *dstp, int width, int subX)
+{
+    int x = 0;
+
+    if (!subX)
+    {
+        for (; x + 32 <= width; x += 32)
+            _mm512_storeu_si512(dstp + x, _mm512_avg_epu16(_mm512_loadu_si512(row0 + x), _mm512_loadu_si512(row1 + x)));
+    }
+    else
+    {
+        // The first sample mirrors its left neighbour.
+        vmaf_downsample16_tail(row0, row1, dstp, 0, std::min(width, 1), subX);
+
+        const __m512i mask = _mm512_set1_epi32(0xFFFF);
+        const __m512i order = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+
+        auto load = [&](int i) { return _mm512_avg_epu16(_mm512_loadu_si512(row0 + i), _mm512_loadu_si512(row1 + i)); };
+        auto even = [&](__m512i a, __m512i b) { return _mm512_permutexvar_epi64(order, _mm512_packus_epi32(_mm512_and_si512(a, mask), _mm512_and_si512(b, mask))); };
+        auto odd = [&](__m512i a, __m512i b) { return _mm512_permutexvar_epi64(order, _mm512_packus_epi32(_mm512_srli_epi32(a, 16), _mm512_srli_epi32(b, 16))); };
+
+        for (x = 1; x + 32 <= width; x += 32)
+        {
+            const __m512i left = odd(load(2 * x - 2), load(2 * x + 30));
+            const __m512i center0 = load(2 * x);
+            const __m512i center1 = load(2 * x + 32);
+
+            _mm512_storeu_si512(dstp + x, _mm512_avg_epu16(_mm512_avg_epu16(left, odd(center0, center1)), even(center0, center1)));
+        }
+    }
+
+    vmaf_downsample16_tail(row0, row1, dstp, x, width, subX);
+}
+
+static inline __m512 vmaf_load16(const uint8_t *srcp)
+{
+    return _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(srcp))));
+}
+
+static inline __m512 vmaf_load16(const uint16_t *srcp)
+{
+    return _mm512_cvtepi32_ps(_mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(srcp))));
+}
+
+static inline __m512 vmaf_load16(const float *srcp)
+{
+    return _mm512_loadu_ps(srcp);
+}
+
+static inline void vmaf_store16(uint8_t *dstp, __m512i v)
+{
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dstp), _mm512_cvtepi32_epi8(v));
+}
+
+static inline void vmaf_store16(uint16_t *dstp, __m512i v)
+{
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dstp), _mm512_cvtepi32_epi16(v));
+}
+
+template <typename T, typename O>
+static int vmaf_rgb_avx512(const uint8_t *const *srcp, uint8_t *const *dstp, int width, const VMAFMatrix *matrix)
+{
+    const T *r = reinterpret_cast<const T *>(srcp[0]);
+    const T *g = reinterpret_cast<const T *>(srcp[1]);
+    const T *b = reinterpret_cast<const T *>(srcp[2]);
+    const int planes = (dstp[1]) ? 3 : 1;
+
+    __m512 m[3][3], offset[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        for (int j = 0; j < 3; ++j)
+            m[i][j] = _mm512_set1_ps(matrix->m[i][j]);
+
+        offset[i] = _mm512_set1_ps(matrix->offset[i]);
+    }
+
+    const __m512i min = _mm512_setzero_si512();
+    const __m512i max = _mm512_set1_epi32(matrix->peak);
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        const __m512 rv = vmaf_load16(r + x);
+        const __m512 gv = vmaf_load16(g + x);
+        const __m512 bv = vmaf_load16(b + x);
+
+        for (int i = 0; i < planes; ++i)
+        {
+            // Same order as the C version, no fma.
+            const __m512 v = _mm512_add_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(m[i][0], rv), _mm512_mul_ps(m[i][1], gv)), _mm512_mul_ps(m[i][2], bv)), offset[i]);
+            vmaf_store16(reinterpret_cast<O *>(dstp[i]) + x, _mm512_min_epi32(_mm512_max_epi32(_mm512_cvtps_epi32(v), min), max));
+        }
+    }
+
+    return x;
+}
+
+void vmaf_rgb_row_avx512(const uint8_t *const *srcp, uint8_t *const *dstp, int width, int bits, int bpc, const VMAFMatrix *matrix)
+{
+    int x;
+
+    if (bits == 8)
+        x = (bpc == 8) ? vmaf_rgb_avx512<uint8_t, uint8_t>(srcp, dstp, width, matrix) : vmaf_rgb_avx512<uint8_t, uint16_t>(srcp, dstp, width, matrix);
+    else if (bits == 32)
+        x = (bpc == 8) ? vmaf_rgb_avx512<float, uint8_t>(srcp, dstp, width, matrix) : vmaf_rgb_avx512<float, uint16_t>(srcp, dstp, width, matrix);
+    else
+        x = (bpc == 8) ? vmaf_rgb_avx512<uint16_t, uint8_t>(srcp, dstp, width, matrix) : vmaf_rgb_avx512<uint16_t, uint16_t>(srcp, dstp, width, matrix);
+
+    vmaf_rgb_row_tail(srcp, dstp, x, width, bits, bpc, matrix);
+}
+
+template <typename T>
+static int vmaf_resize_h_avx512(const uint8_t *srcp, uint16_t *dstp, int width, int taps, const int *left, const int32_t *coef, int peak)
+{
+    const __m512i mask = _mm512_set1_epi32((sizeof(T) == 1) ? 0xFF : 0xFFFF);
+    const __m512i round = _mm512_set1_epi32(8192);
+    const __m512i min = _mm512_setzero_si512();
+    const __m512i max = _mm512_set1_epi32(peak);
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        const __m512i idx = _mm512_loadu_si512(left + x);
+        __m512i sum = round;
+
+        for (int k = 0; k < taps; ++k)
+        {
+            // The source rows are padded, the gather may read past the last sample.
+            const __m512i v = _mm512_and_si512(_mm512_i32gather_epi32(_mm512_add_epi32(idx, _mm512_set1_epi32(k)), srcp, sizeof(T)), mask);
+            sum = _mm512_add_epi32(sum, _mm512_mullo_epi32(v, _mm512_loadu_si512(coef + k * width + x)));
+        }
+
+        sum = _mm512_min_epi32(_mm512_max_epi32(_mm512_srai_epi32(sum, 14), min), max);
+        vmaf_store16(dstp + x, sum);
+    }
+
+    return x;
+}
+
+void vmaf_resize_h_avx512(const uint8_t *srcp, uint16_t *dstp, int width, int taps, const int *left, const int32_t *coef, int bpc, int peak)
+{
+    const int x = (bpc == 8) ? vmaf_resize_h_avx512<uint8_t>(srcp, dstp, width, taps, left, coef, peak)
+                             : vmaf_resize_h_avx512<uint16_t>(srcp, dstp, width, taps, left, coef, peak);
+
+    vmaf_resize_h_tail(srcp, dstp, x, width, taps, left, coef, bpc, peak);
+}
+
+void vmaf_resize_v_avx512(const uint16_t *const *rows, uint8_t *dstp, int width, int taps, const int32_t *coef, int bpc, int peak)
+{
+    const __m512i round = _mm512_set1_epi32(8192);
+    const __m512i min = _mm512_setzero_si512();
+    const __m512i max = _mm512_set1_epi32(peak);
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        __m512i sum = round;
+
+        for (int k = 0; k < taps; ++k)
+        {
+            const __m512i v = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(rows[k] + x)));
+            sum = _mm512_add_epi32(sum, _mm512_mullo_epi32(v, _mm512_set1_epi32(coef[k])));
+        }
+
+        sum = _mm512_min_epi32(_mm512_max_epi32(_mm512_srai_epi32(sum, 14), min), max);
+
+        if (bpc == 8)
+            vmaf_store16(dstp + x, sum);
+        else
+            vmaf_store16(reinterpret_cast<uint16_t *>(dstp) + x, sum);
+    }
+
+    vmaf_resize_v_tail(rows, dstp, x, width, taps, coef, bpc, peak);
+}
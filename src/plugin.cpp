@@ -2,7 +2,7 @@
 
 const char *AVSC_CC avisynth_c_plugin_init(AVS_ScriptEnvironment *env)
 {
-    avs_add_function(env, "VMAF", "ccs[log_format]i[model]i*[feature]i*[cambi_opt]s", Create_VMAF, 0);
-    avs_add_function(env, "VMAF2", "c[distorted]c[feature]i*[cambi_opt]s", Create_VMAF2, 0);
+    avs_add_function(env, "VMAF", "cc+s+[log_format]i[model]i*[feature]i*[cambi_opt]s[queue_depth]i[threads]i[subsample]i[cpumask]i[shards]i[lookahead]i[window]i[pool]s[cache_path]s[matrix]s[scale]s[start]i[end]i[step]i[keyframes]b[timing]i[trace_path]s[thread_weight]f", Create_VMAF, 0);
+    avs_add_function(env, "VMAF2", "c[distorted]c[feature]i*[cambi_opt]s[threads]i[cpumask]i[matrix]s[scale]s[timing]b[trace_path]s[thread_weight]f", Create_VMAF2, 0);
     return "VMAF";
 }